@@ -0,0 +1,19 @@
+#version 400 core
+/* audio textures and midi controllers, exercises the shared inputs */
+out vec4 color;
+uniform float time;
+uniform vec2 v2Resolution;
+uniform sampler1D texFFT;
+uniform sampler1D texFFTSmoothed;
+uniform sampler1D texSND;
+uniform float cc1;
+uniform float c0cc2;
+
+void main() {
+	vec2 uv = gl_FragCoord.xy / v2Resolution;
+	float f = texture(texFFT, uv.x).r;
+	float s = texture(texFFTSmoothed, uv.x).r;
+	float w = texture(texSND, uv.x).r;
+	float l = smoothstep(0.01, 0.0, abs(uv.y - 0.5 - 0.5 * w));
+	color = vec4(f + l, s + cc1, c0cc2 + 0.1 * sin(time), 1.0);
+}
@@ -0,0 +1,32 @@
+#version 400 core
+/* value noise fbm, heavy on arithmetic */
+out vec4 color;
+uniform float time;
+uniform vec2 v2Resolution;
+
+float hash(vec2 p) {
+	return fract(sin(dot(p, vec2(127.1, 311.7))) * 43758.5453);
+}
+
+float noise(vec2 p) {
+	vec2 i = floor(p), f = fract(p);
+	vec2 u = f * f * (3.0 - 2.0 * f);
+	return mix(mix(hash(i), hash(i + vec2(1, 0)), u.x),
+		   mix(hash(i + vec2(0, 1)), hash(i + vec2(1, 1)), u.x), u.y);
+}
+
+float fbm(vec2 p) {
+	float v = 0.0, a = 0.5;
+	for (int i = 0; i < 8; i++) {
+		v += a * noise(p);
+		p = p * 2.0 + vec2(1.7, 9.2);
+		a *= 0.5;
+	}
+	return v;
+}
+
+void main() {
+	vec2 uv = gl_FragCoord.xy / v2Resolution.y * 3.0;
+	float v = fbm(uv + fbm(uv + time * 0.1));
+	color = vec4(vec3(v), 1.0);
+}
@@ -0,0 +1,13 @@
+#version 400 core
+/* cheap per-pixel trigonometry, the baseline */
+out vec4 color;
+uniform float time;
+uniform vec2 v2Resolution;
+
+void main() {
+	vec2 uv = gl_FragCoord.xy / v2Resolution.y;
+	float v = sin(uv.x * 10.0 + time)
+		+ sin((uv.y * 10.0 + time) * 0.5)
+		+ sin(length(uv * 10.0) + time);
+	color = vec4(0.5 + 0.5 * cos(v + vec3(0.0, 2.0, 4.0)), 1.0);
+}
@@ -0,0 +1,27 @@
+#version 400 core
+/* sphere traced sdf scene, long data dependent loops */
+out vec4 color;
+uniform float time;
+uniform vec2 v2Resolution;
+
+float map(vec3 p) {
+	vec3 q = mod(p, 2.0) - 1.0;
+	float s = length(q) - 0.4;
+	float b = length(max(abs(q) - vec3(0.25), 0.0)) - 0.05;
+	return mix(s, b, 0.5 + 0.5 * sin(time));
+}
+
+void main() {
+	vec2 uv = (2.0 * gl_FragCoord.xy - v2Resolution) / v2Resolution.y;
+	vec3 ro = vec3(0.0, 0.0, time), rd = normalize(vec3(uv, 1.5));
+	float t = 0.0;
+	int i;
+
+	for (i = 0; i < 96; i++) {
+		float d = map(ro + rd * t);
+		if (d < 0.001 || t > 40.0)
+			break;
+		t += d;
+	}
+	color = vec4(vec3(1.0 - float(i) / 96.0), 1.0);
+}
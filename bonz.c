@@ -5,12 +5,21 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <errno.h>
-
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include "glad.h"
 #include <SDL.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 
 #define SINGLE_WIN 1
 
@@ -22,6 +31,19 @@
 
 #define GLSL_VERSION "#version 400 core\n"
 
+/* extensions beyond the GL 4.1 entry points glad was generated for */
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+static PFNGLBUFFERSTORAGEPROC gl_buffer_storage;
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+static PFNGLMAXSHADERCOMPILERTHREADSKHRPROC gl_max_shader_compiler_threads;
+
 struct texture {
 	GLenum unit;
 	GLenum type;
@@ -34,6 +56,17 @@ static unsigned int default_width = 1080;
 static unsigned int default_height = 800;
 
 static SDL_GLContext gl_ctx;
+
+/* headless rendering of a fixed number of frames, to qoi files or timed */
+static struct {
+	const char *path;
+	int bench;
+	unsigned int fps;
+	unsigned int frames;
+	unsigned int size_count;
+	unsigned int size[8][2];
+	unsigned int frame;
+} offline = { .fps = 60 };
 static double time_start;
 static double xpos, ypos;
 static int buttons[8];
@@ -49,16 +82,106 @@ static inline int mouse_right_click(void) { return mouse_click(3); }
 
 static int verbose;
 static int show_gui;
+static int show_hud;
 static char *argv0;
 static GLuint quad_vao;
 static GLuint quad_vbo;
 static GLuint vshd;
 
+enum uniform_src {
+	UNIFORM_TIME,
+	UNIFORM_RESOLUTION,
+	UNIFORM_BUF_SCALE,	/* part of the buffers drawn, of live_scale_max */
+	UNIFORM_CC,		/* ccN: last value of cc N on any channel */
+	UNIFORM_CHAN_CC,	/* cXccN: value of cc N on channel X */
+	UNIFORM_TEX_BUF,	/* bufA..: output of a buffer pass, chn is its index */
+	UNIFORM_TEX_FFT,	/* samplers, in enum audio_tex order */
+	UNIFORM_TEX_FFT_SMTH,
+	UNIFORM_TEX_SND,
+};
+
+enum audio_tex {
+	AUDIO_FFT,
+	AUDIO_FFT_SMTH,
+	AUDIO_SND,
+	AUDIO_TEX_COUNT,
+};
+
+struct uniform {
+	GLint loc;
+	GLenum type;
+	unsigned char src;
+	unsigned char chn;
+	unsigned char num;
+};
+
+/*
+ * Non-blocking GL_TIME_ELAPSED measurement: results are read back from a
+ * small ring of queries a few frames after they were issued, and the last
+ * GPU_TIMER_HIST of them are kept for the rolling average and maximum.
+ */
+#define GPU_TIMER_QUERIES 4
+#define GPU_TIMER_HIST 32
+struct gpu_timer {
+	GLuint query[GPU_TIMER_QUERIES];
+	unsigned int head, tail;
+	int active;
+	double last_ms;
+	unsigned int count;
+	float hist[GPU_TIMER_HIST];
+};
+
+/*
+ * Buffer passes, declared in the source by "#pragma buffer A [scale]" up to
+ * D, are built from the same source with BUFFER_A.. defined and drawn in
+ * order into float targets before the image. The bufA..bufD samplers read
+ * this frame's output of the passes before, and the previous frame of the
+ * pass itself and of the ones after. Targets are sized for the largest live
+ * scale and drawn in the corner the current one covers, so they are sampled
+ * at uv * fBufScale.
+ */
+#define PASS_MAX 4
+#define PASS_IMAGE PASS_MAX	/* index of the image in a build */
+struct pass {
+	GLuint prog;	/* 0 when not declared */
+	float scale;	/* of the live size */
+	size_t uniform_count;
+	struct uniform *uniforms;
+	unsigned int audio_mask;
+	unsigned int buf_mask;	/* bit per buffer sampled */
+};
+
+/* a program being built, see compile_loop */
+struct build_prog {
+	GLuint prog;
+	GLuint fshd;
+	uint64_t key;
+	int cached;
+};
+struct build {
+	struct build_prog p[PASS_MAX + 1];	/* buffers A.., the image last */
+	float scale[PASS_MAX];	/* 0 for the buffers not declared */
+	GLsync fence;
+	uint64_t hash;
+};
+
 struct shader {
 	GLuint prog;
 	GLuint fshd;
+	struct build *built;	/* handed over by the compile thread */
+	struct build *pending;	/* waiting on its fence, render thread only */
 	char *name;
 	time_t time;
+	uint64_t hash;	/* source of the last good build, by whoever builds */
+	uint32_t deps;	/* includes pulled in by the last build */
+	int request;	/* 1 + force of a reload the full job queue refused */
+	size_t uniform_count;
+	struct uniform *uniforms;
+	unsigned int audio_mask;	/* bit per enum audio_tex sampled, by any pass */
+	unsigned int buf_mask;
+	struct pass pass[PASS_MAX];
+	struct gpu_timer live_timer;
+	struct gpu_timer thumb_timer;
 };
 static size_t shader_count;
 static struct shader shaders[16];
@@ -66,26 +189,257 @@ static GLuint shaders_fbo;
 static struct texture tex_shd;
 static struct shader *shader;
 
+static struct gpu_timer gui_timer;
+
+/* cpu time of each stage of the last frame, and recent frame times */
+enum perf_stage {
+	PERF_INPUT,
+	PERF_POLL,
+	PERF_UNIFORMS,
+	PERF_DRAW,
+	PERF_SWAP,
+	PERF_STAGES,
+};
+static const char *perf_stage_name[PERF_STAGES] = {
+	"input", "poll", "uniforms", "draw", "swap",
+};
+#define PERF_FRAMES 128
+static struct {
+	double start;
+	double mark;
+	float stage[PERF_STAGES];
+	unsigned int count;
+	float frame[PERF_FRAMES];
+} perf;
+
+/*
+ * Late rendering: sleep until the predicted vblank less the expected
+ * frame cost and a safety margin, then sample input and render, so what
+ * reaches the display is at most a frame cost old instead of a full
+ * refresh. The margin grows on a missed vblank and shrinks back slowly.
+ * The vblanks are timed by the swap returning: the fence of the frame
+ * before is waited on first, so with one frame queued the swap returns
+ * once that frame is flipped. The gpu timers only go into the cost.
+ */
+#define PACE_MARGIN_MIN 0.5
+#define PACE_MARGIN_MAX 8.0
+static struct {
+	int on;
+	double period;	/* ms between vblanks */
+	double vblank;	/* phase, from the swaps returning */
+	double swapped;	/* return of the last swap */
+	GLsync fence;	/* behind the last swap */
+	unsigned long swaps;
+	double cost;	/* decaying peak of the cpu and gpu ms of a frame */
+	double margin;
+	double slept;
+	unsigned long frames, missed, late;
+} pace;
+
+/*
+ * The render thread owns the GL context. The main thread waits on SDL
+ * events and polls the shader files, and hands both over through single
+ * producer, single consumer rings, so neither delays a frame.
+ */
+enum event_type {
+	EV_KEY,
+	EV_MOTION,
+	EV_BUTTON,
+	EV_RELOAD,
+};
+struct event {
+	int type;
+	int key;	/* keysym, button or shader index */
+	int x, y;	/* pointer, x forces a reload of unchanged source */
+};
+#define EVQ_SIZE 256	/* power of two */
+struct evq {
+	struct event ev[EVQ_SIZE];
+	unsigned long head, tail;
+	unsigned long dropped;
+};
+static struct evq input_queue, file_queue;
+static pthread_t render_thread;
+static int quit;
+#define POLL_MS 50
+
+/*
+ * Live reloads are built on a compile thread, in a context sharing objects
+ * with the render one and bound to a hidden window of its own. The program
+ * is linked and drawn once there, and the render thread swaps it in only
+ * once the fence behind that draw has signaled, keeping the old program on
+ * screen until then.
+ */
+static struct {
+	SDL_Window *win;
+	SDL_GLContext ctx;
+	pthread_t thread;
+	int running;
+	sem_t sem;
+	struct evq jobs;
+	GLuint vao, fbo, tex;
+	unsigned long built, failed, unchanged;
+	double ms, max_ms;
+} compile;
+
+/*
+ * Shader files are watched through their parent directories, so editors
+ * saving to a temporary file renamed over the original are seen as well.
+ * Events for a file are debounced, then the file is hashed and a reload
+ * queued only when its content changed.
+ */
+#define WATCH_DEBOUNCE_MS 30
+static struct {
+	int fd;
+	pthread_t thread;
+	int wd[LEN(shaders)];
+	double due[LEN(shaders)];	/* end of the debounce, 0 when idle */
+	uint64_t hash[LEN(shaders)];
+	unsigned long events, reloads, unchanged;
+} watch = { .fd = -1 };
+
+/* included files are watched too, as soon as the table has them */
+struct include;
+static void die(const char *fmt, ...) __noreturn;
+static void include_watch(struct include *inc);
+#define SRC_DIE die
+#define SRC_INCLUDE_ADDED(inc) include_watch(inc)
+#define SRC_IMPLEMENTATION
+#include "src.h"
+
+/*
+ * Render graph of the live shader, planned again when its programs or the
+ * window size change. Passes reading time or audio run every frame and share
+ * targets with passes whose output is no longer needed. A pass reading
+ * itself swaps two targets, a pass read before it runs keeps its target
+ * until the next frame. The other passes keep their target and run only
+ * when a controller they read or a pass before them changed.
+ */
+#define TARGET_MAX (2 * PASS_MAX)
+struct target {
+	GLuint tex, fbo;
+	int w, h;
+};
+static struct {
+	struct shader *shader;
+	GLuint prog[PASS_MAX];
+	int w, h;	/* live size at live_scale_max */
+	double scale;	/* part of the targets drawn */
+	struct target target[TARGET_MAX];
+	size_t target_count;
+	int cur[PASS_MAX], prev[PASS_MAX];	/* targets, prev only on self reads */
+	unsigned int varying;	/* passes run every frame */
+	unsigned int valid;	/* other passes with an up to date output */
+	unsigned int ran;	/* passes drawn in the last frame */
+	uint64_t inputs[PASS_MAX];	/* controller values at their last run */
+	int fresh;	/* a frame started, the passes are not drawn yet */
+	unsigned long runs, skips, plans;
+	size_t bytes;
+} graph;
+static GLuint buf_unit;	/* first of the PASS_MAX units of the bufX samplers */
+
+/* the live pass renders offscreen at a scale driven by its gpu time */
+static GLuint live_fbo;
+static struct texture tex_live;
+static int live_w, live_h;
+static double live_scale = 1.0;
+static double live_scale_min = 0.25;
+static double live_scale_max = 1.0;
+static double live_target_ms;	/* 0 until set or taken from the refresh */
+static double live_hysteresis = 0.15;
+static unsigned int live_settle;
+
+/*
+ * Thumbnails refreshed per frame while the grid is shown, within a budget
+ * of gpu time, each costing the average of its timer, or of pixels. One
+ * is always refreshed, one not measured yet is refreshed alone.
+ */
+static double thumb_budget = 1.0;
+static int thumb_budget_px;	/* thumb_budget counts pixels, not ms */
+static size_t thumb_next;
+#define THUMB_SIZE 128
+
 static struct texture tex_gui;
-static struct texture tex_snd;
-static struct texture tex_fft;
-static struct texture tex_fft_smth;
+static struct texture tex_audio[AUDIO_TEX_COUNT];
 static float smth_fac = 0.9;
 
-static char *frag;
-static size_t frag_size;
+static const char *vert_src =
+	GLSL_VERSION
+	"layout (location = 0) in vec2 a_pos;\n"
+	"out vec2 texcoord;\n"
+	"void main() {\n"
+	"	gl_Position = vec4(a_pos - 0.5, 0.0, 0.5);\n"
+	"	texcoord = a_pos;\n"
+	"}\n";
+
+/* linked programs saved with glGetProgramBinary, keyed by a hash of both
+ * sources and of the driver strings */
+static struct {
+	int on;
+	char dir[4096];
+	uint64_t driver;
+	unsigned long hits, misses, stores;
+} prog_cache;
+
+/* fragment source as handed to glShaderSource, with the bonz block injected */
+struct shader_src {
+	GLsizei count;
+	const GLchar *str[64];
+	GLint len[64];
+	size_t defs_len;
+	char defs[2048];
+};
+
+/* std140 layout of the bonz uniform block, shared by every program */
+#define BONZ_BINDING 0
+struct bonz_block {
+	float resolution[2];
+	float time;
+	float buf_scale;
+	/* packed bytes: 16 midi channels, plus the last value on any channel */
+	unsigned char cc[17][128];
+};
+static struct bonz_block bonz_block;
+static GLuint bonz_ubo;
 
 static char logbuf[4096];
 static GLsizei logsize;
 static unsigned char midi_cc_last[128];
 static unsigned char midi_cc[16][128];
 
+/*
+ * One bit per controller that changed since the last upload, set by the
+ * jack thread and consumed by the render thread. Row 16 is midi_cc_last.
+ */
+static uint32_t midi_dirty[17][128 / 32];
+static struct {
+	unsigned long uploaded;
+	unsigned long skipped;
+} cc_stats;
+
 #include <fftw3.h>
 #define FFT_SIZE 2048
 static float fftw_in[FFT_SIZE], fftw_out[FFT_SIZE];
 static float fft_smth[FFT_SIZE];
 static fftwf_plan plan;
 
+/* per-frame copy of the jack buffers, shared by every program */
+static float *const audio_src[AUDIO_TEX_COUNT] = { fftw_out, fft_smth, fftw_in };
+
+/*
+ * Pixel unpack buffers the audio snapshot is streamed through: a ring of
+ * slots in one persistently mapped buffer guarded by fences, or a single
+ * buffer orphaned every frame when GL_ARB_buffer_storage is missing.
+ */
+#define AUDIO_PBO_SLOTS 3
+#define AUDIO_PBO_SIZE (sizeof(float) * AUDIO_TEX_COUNT * FFT_SIZE)
+static struct {
+	GLuint pbo;
+	float *map;
+	size_t slot;
+	GLsync fence[AUDIO_PBO_SLOTS];
+} audio_pbo;
+
 #include <jack/jack.h>
 #include <jack/midiport.h>
 
@@ -93,16 +447,95 @@ static jack_client_t *jack;
 static jack_port_t *midi_port;
 static jack_port_t *input_port;
 
+/*
+ * Age of the audio on screen: the jack thread stamps each period with the
+ * monotonic time its newest sample was captured, the render thread keeps
+ * the stamp of the snapshot it uploads and compares it to the flip that
+ * shows it, timed by pacing as the return of the next swap.
+ */
+#define LAT_BINS 64	/* 1 ms each, the last one counts anything longer */
+#define LAT_FRAMES 128
+static struct {
+	uint64_t capture_us;	/* jack thread */
+	uint64_t shown_us, prev_us;
+	uint64_t queued_us;	/* of the frame behind swap number queued */
+	unsigned long queued;
+	unsigned long bin[LAT_BINS];
+	unsigned long count, repeats;
+	float ms[LAT_FRAMES];
+	double max;
+} audio_lat;
+
 #include "qoi.h"
+#include "qoi_simd.h"
+#include "qois.h"
+
+/*
+ * Recording of the live output: frames are read back into a ring of pixel
+ * pack buffers that are only mapped once their fence has signaled, a few
+ * frames later, then handed through a bounded lock-free queue to a pool of
+ * workers that flip, encode and write them, in capture order.
+ */
+#define REC_PBOS 3
+#define REC_QUEUE_SIZE 8	/* power of two */
+#define REC_WORKERS_MAX 8
+#define REC_STRIPES 16	/* for .qois output */
+struct rec_frame {
+	unsigned long seq;
+	unsigned int num;
+	int w, h;
+	unsigned char pix[];
+};
+struct rec_cell {
+	unsigned long seq;
+	struct rec_frame *f;
+};
+static struct {
+	int on;
+	int block;	/* wait for the gpu and the workers rather than drop */
+	const char *path;
+	int w, h;
+	GLuint pbo[REC_PBOS];
+	GLsync fence[REC_PBOS];
+	unsigned int num[REC_PBOS];
+	unsigned int head, tail;
+	unsigned int frame;
+	unsigned long captured, dropped, written;
+
+	/* single producer, multiple consumers */
+	struct rec_cell cell[REC_QUEUE_SIZE];
+	unsigned long push, pop;
+	unsigned long pushed;
+	sem_t items, space;
+	unsigned long depth_max;
+
+	/* workers wait for their turn to write */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long order;
+
+	int worker_count;
+	pthread_t worker[REC_WORKERS_MAX];
+	int stripes, stripe_threads;
+	unsigned long encode_count;
+	double encode_ms, encode_max;
+} rec = {
+	.path = "bonz%05d.qoi",
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
 
 #define GUI_IMPLEMENTATION
 #include "gui.h"
 static struct gui_state gui_state;
 static GLuint gui_prg;
 
-static void fini(void);
-static void die(const char *fmt, ...) __noreturn;
+static void jack_fini(void);
 
+/*
+ * Any thread may die, most of them without the render context, so leave
+ * the gl teardown (and the recording) to fini on the thread owning it.
+ */
 static void
 die(const char *fmt, ...)
 {
@@ -112,7 +545,7 @@ die(const char *fmt, ...)
 	vfprintf(stderr, fmt, ap);
 	va_end(ap);
 
-	fini();
+	jack_fini();
 	exit(1);
 }
 
@@ -120,13 +553,57 @@ die(const char *fmt, ...)
 static double
 get_time(void)
 {
+	if (offline.path || offline.bench)
+		return offline.frame / (double) offline.fps;
 	return SDL_GetTicks() / (double) MSEC_PER_SEC;
 }
 
+static void
+midi_mark(size_t chn, size_t num)
+{
+	__atomic_fetch_or(&midi_dirty[chn][num / 32], 1u << (num % 32), __ATOMIC_RELEASE);
+}
+
+static double
+clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+perf_begin(void)
+{
+	double t = clock_ms();
+
+	if (perf.start > 0.0)
+		perf.frame[perf.count++ % LEN(perf.frame)] = t - perf.start;
+	perf.start = perf.mark = t;
+}
+
+static void
+perf_mark(enum perf_stage stage)
+{
+	double t = clock_ms();
+
+	perf.stage[stage] = t - perf.mark;
+	perf.mark = t;
+}
+
+static int
+cmp_float(const void *a, const void *b)
+{
+	float x = *(const float *)a, y = *(const float *)b;
+
+	return (x > y) - (x < y);
+}
+
 static void
 panic(void)
 {
-	int i;
+	size_t i, j;
 	if (verbose)
 		printf("panic\n");
 	time_start = get_time();
@@ -134,15 +611,19 @@ panic(void)
 	for (i = 0; i < 16; i++) {
 		memset(midi_cc[i], 0, sizeof(midi_cc_last));
 	}
+	for (i = 0; i < LEN(midi_dirty); i++)
+		for (j = 0; j < LEN(midi_dirty[i]); j++)
+			__atomic_store_n(&midi_dirty[i][j], ~0u, __ATOMIC_RELEASE);
 }
 
+static GLuint tex_units;	/* next free texture unit */
+
 static struct texture
 create_tex(GLenum type)
 {
 	struct texture tex = {0};
-	static GLuint unit = 0;
 
-	tex.unit = unit++;
+	tex.unit = tex_units++;
 	tex.type = type;
 	glGenTextures(1, &tex.id);
 
@@ -188,11 +669,11 @@ update_1dr32_tex(struct texture *tex, void *data, size_t size)
 }
 
 static int
-shader_compile(GLuint shd, const GLchar *txt, GLint len)
+shader_compile_src(GLuint shd, GLsizei count, const GLchar **str, const GLint *len)
 {
 	int ret;
 
-	glShaderSource(shd, 1, &txt, &len);
+	glShaderSource(shd, count, str, len);
 	glCompileShader(shd);
 	glGetShaderiv(shd, GL_COMPILE_STATUS, &ret);
 	if (!ret) {
@@ -202,6 +683,12 @@ shader_compile(GLuint shd, const GLchar *txt, GLint len)
 	return ret;
 }
 
+static int
+shader_compile(GLuint shd, const GLchar *txt, GLint len)
+{
+	return shader_compile_src(shd, 1, &txt, &len);
+}
+
 static int
 shader_link(GLuint prog, GLuint vert, GLuint frag)
 {
@@ -218,255 +705,2097 @@ shader_link(GLuint prog, GLuint vert, GLuint frag)
 	return ret;
 }
 
-static void
-shader_reload(struct shader *s)
+static int
+parse_uint(const char **str, unsigned int max)
 {
-	GLuint nprg;
-	GLuint fshd = glCreateShader(GL_FRAGMENT_SHADER);
-	FILE *file = fopen(s->name, "r");
-	long size = 0;
-	const GLchar *src;
-	GLint len;
-	GLint loc;
+	const char *p = *str;
+	unsigned int v = 0;
+
+	if (*p < '0' || *p > '9')
+		return -1;
+	if (p[0] == '0' && p[1] >= '0' && p[1] <= '9')
+		return -1;
+	for (; *p >= '0' && *p <= '9'; p++) {
+		v = v * 10 + (*p - '0');
+		if (v >= max)
+			return -1;
+	}
+	*str = p;
+	return v;
+}
 
-	if (!file) {
-		fprintf(stderr, "%s: %s\n", s->name, strerror(errno));
-		return;
+static int
+uniform_parse(struct uniform *u, const char *name)
+{
+	static const struct {
+		const char *name;
+		enum uniform_src src;
+	} named[] = {
+		{ "fGlobalTime", UNIFORM_TIME },
+		{ "time", UNIFORM_TIME },
+		{ "v2Resolution", UNIFORM_RESOLUTION },
+		{ "fBufScale", UNIFORM_BUF_SCALE },
+		{ "texFFT", UNIFORM_TEX_FFT },
+		{ "texFFTSmoothed", UNIFORM_TEX_FFT_SMTH },
+		{ "texSND", UNIFORM_TEX_SND },
+	};
+	const char *p = name;
+	int chn, num;
+	size_t i;
+
+	for (i = 0; i < LEN(named); i++) {
+		if (strcmp(name, named[i].name) == 0) {
+			u->src = named[i].src;
+			return 1;
+		}
 	}
 
-	fseek(file, 0, SEEK_END);
-	size = ftell(file);
-	if (size < 0) {
-		fprintf(stderr, "%s: ftell: %s\n", s->name, strerror(errno));
-		return;
+	if (strncmp(name, "buf", 3) == 0 && name[3] >= 'A' &&
+	    name[3] < 'A' + PASS_MAX && name[4] == '\0') {
+		u->src = UNIFORM_TEX_BUF;
+		u->chn = name[3] - 'A';
+		return 1;
 	}
-	fseek(file, 0, SEEK_SET);
-	if ((size_t)size >= frag_size)
-		frag = realloc(frag, frag_size = size + 1024);
-	fread(frag, sizeof(char), size, file);
-	frag[size] = '\0';
-	fclose(file);
 
-	src = frag;
-	len = size;
-	if (!shader_compile(fshd, src, len)) {
-		glDeleteShader(fshd);
-		return;
+	/* ccN or cXccN */
+	if (*p++ != 'c')
+		return 0;
+	if (*p == 'c') {
+		p++;
+		u->src = UNIFORM_CC;
+		chn = 0;
+	} else {
+		u->src = UNIFORM_CHAN_CC;
+		chn = parse_uint(&p, 16);
+		if (chn < 0 || *p++ != 'c' || *p++ != 'c')
+			return 0;
 	}
-	nprg = glCreateProgram();
-	if (!shader_link(nprg, vshd, fshd)) {
-		glDeleteProgram(nprg);
-		glDeleteShader(fshd);
+	num = parse_uint(&p, 128);
+	if (num < 0 || *p != '\0')
+		return 0;
+	u->chn = chn;
+	u->num = num;
+	return 1;
+}
+
+static const char bonz_header[] =
+	"layout(std140) uniform bonz {\n"
+	"	vec2 bonz_resolution;\n"
+	"	float bonz_time;\n"
+	"	float bonz_buf_scale;\n"
+	"	uvec4 bonz_cc[17 * 8];\n"
+	"};\n"
+	"uint bonz_ccu(uint c, uint n) {\n"
+	"	uint i = c * 128u + n;\n"
+	"	return (bonz_cc[i / 16u][(i / 4u) % 4u] >> (8u * (i % 4u))) & 0xffu;\n"
+	"}\n"
+	"float bonz_ccf(uint c, uint n) { return float(bonz_ccu(c, n)) / 127.0; }\n";
+
+static int
+src_push(struct shader_src *ss, const char *str, size_t len)
+{
+	if (ss->count >= (GLsizei)LEN(ss->str))
+		return 0;
+	ss->str[ss->count] = str;
+	ss->len[ss->count] = len;
+	ss->count++;
+	return 1;
+}
+
+/*
+ * Turn a 'uniform <type> <name>;' line for a value provided by the bonz
+ * block into a #define of the same name, keeping line numbers intact.
+ * Returns the length of the define written in buf, or 0.
+ */
+static int
+compat_decl(const char *p, const char *end, char *buf, size_t size)
+{
+	char word[16], type[8], name[16];
+	struct uniform u;
+	int n;
+
+	p = next_word(p, end, word, sizeof(word));
+	if (strcmp(word, "uniform") != 0)
+		return 0;
+	p = next_word(p, end, type, sizeof(type));
+	p = next_word(p, end, name, sizeof(name));
+	p = skip_blank(p, end);
+	if (p == end || *p++ != ';')
+		return 0;
+	p = skip_blank(p, end);
+	if (p < end && *p != '\n' && *p != '\r' && (p + 1 >= end || p[0] != '/' || p[1] != '/'))
+		return 0;
+	if (!uniform_parse(&u, name))
+		return 0;
+
+	if (u.src == UNIFORM_TIME && strcmp(type, "float") == 0)
+		return snprintf(buf, size, "#define %s bonz_time", name);
+	if (u.src == UNIFORM_BUF_SCALE && strcmp(type, "float") == 0)
+		return snprintf(buf, size, "#define %s bonz_buf_scale", name);
+	if (u.src == UNIFORM_CC)
+		u.chn = 16;
+	else if (u.src != UNIFORM_CHAN_CC)
+		return 0;
+
+	if (strcmp(type, "float") == 0)
+		n = snprintf(buf, size, "#define %s bonz_ccf(%du, %du)", name, u.chn, u.num);
+	else if (strcmp(type, "uint") == 0)
+		n = snprintf(buf, size, "#define %s bonz_ccu(%du, %du)", name, u.chn, u.num);
+	else if (strcmp(type, "int") == 0)
+		n = snprintf(buf, size, "#define %s int(bonz_ccu(%du, %du))", name, u.chn, u.num);
+	else if (strcmp(type, "bool") == 0)
+		n = snprintf(buf, size, "#define %s (bonz_ccu(%du, %du) != 0u)", name, u.chn, u.num);
+	else
+		return 0;
+
+	return n;
+}
+
+/*
+ * Split the fragment source so the bonz block is injected right after the
+ * #version and #extension lines, and plain uniform declarations of the
+ * controller and time values are redirected to it. Sources older than
+ * GLSL 1.40 have no uniform blocks and are passed unchanged.
+ */
+static void
+shader_src_compat(struct shader_src *ss, const char *txt, size_t len, int pass)
+{
+	const char *p, *eol, *last, *end = txt + len;
+	long version;
+	int line, n, defs = 0;
+
+	ss->count = 0;
+	ss->defs_len = 0;
+
+	last = src_preamble(txt, len, &version);
+	if ((version < 140 && pass == PASS_IMAGE) || last > end) {
+		src_push(ss, txt, len);
 		return;
 	}
 
-	if (s->prog)
-		glDeleteProgram(s->prog);
-	s->prog = nprg;
+	/* before 3.30, #line N numbers the following line N + 1; the source
+	 * goes in as several strings, pin the number of the main file, the
+	 * included text pins its own */
+	for (line = 1, p = txt; p < last; p++)
+		line += *p == '\n';
+	n = 0;
+	if (pass != PASS_IMAGE)
+		n = snprintf(ss->defs, sizeof(ss->defs), "#define BUFFER_%c\n", 'A' + pass);
+	n += snprintf(ss->defs + n, sizeof(ss->defs) - n, "#line %d 0\n",
+		      version < 330 ? line - 1 : line);
+	src_push(ss, txt, last - txt);
+	if (version >= 140)
+		src_push(ss, bonz_header, sizeof(bonz_header) - 1);
+	src_push(ss, ss->defs, n);
+	ss->defs_len = n + 1;
+
+	/* buffers keep plain uniforms, for the render graph to see what they read */
+	if (version < 140 || pass != PASS_IMAGE) {
+		src_push(ss, last, end - last);
+		return;
+	}
 
-	glUseProgram(s->prog);
-	glBindVertexArray(quad_vao);
+	for (p = last; p < end; p = eol + 1) {
+		char *buf = ss->defs + ss->defs_len;
+		size_t size = sizeof(ss->defs) - ss->defs_len;
 
-	loc = glGetAttribLocation(s->prog, "a_pos");
-	if (loc >= 0) {
-		glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
-		glVertexAttribPointer(loc, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-		glEnableVertexAttribArray(loc);
-		glVertexAttribDivisor(loc, 0);
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		/* keep room for the tail of the source */
+		if (ss->count + 3 > (GLsizei)LEN(ss->str))
+			break;
+		n = compat_decl(p, eol, buf, size);
+		if (n <= 0 || (size_t)n >= size)
+			continue;
+		src_push(ss, last, p - last);
+		src_push(ss, buf, n);
+		ss->defs_len += n + 1;
+		last = eol;
+		defs++;
 	}
-	glBindVertexArray(0);
-	printf("--- LOADED --- (%d)\n", nprg);
+	src_push(ss, last, end - last);
+
+	if (verbose)
+		printf("bonz block injected, %d declarations redirected\n", defs);
 }
 
 static void
-texture_init(void)
+program_reflect(GLuint prog, const char *what, struct uniform **uniforms,
+		size_t *uniform_count, unsigned int *audio_mask, unsigned int *buf_mask)
 {
-	tex_fft = create_1dr32_tex(LEN(fftw_out), fftw_out);
-	tex_fft_smth = create_1dr32_tex(LEN(fft_smth), fft_smth);
-	tex_snd = create_1dr32_tex(LEN(fftw_in), fftw_in);
+	GLint i, n, count = 0;
+	GLchar name[64];
+	GLint size;
+	struct uniform u;
+
+	glGetProgramiv(prog, GL_ACTIVE_UNIFORMS, &count);
+	*uniform_count = 0;
+	*audio_mask = 0;
+	*buf_mask = 0;
+	*uniforms = realloc(*uniforms, MAX(count, 1) * sizeof(**uniforms));
+	if (!*uniforms)
+		die("realloc: %s\n", strerror(errno));
+
+	for (i = 0; i < count; i++) {
+		glGetActiveUniform(prog, i, sizeof(name), NULL, &size, &u.type, name);
+		if (!uniform_parse(&u, name))
+			continue;
+		u.loc = glGetUniformLocation(prog, name);
+		if (u.loc < 0)
+			continue;
+		if (u.src == UNIFORM_TEX_BUF) {
+			/* bound to the unit by the render graph */
+			glProgramUniform1i(prog, u.loc, buf_unit + u.chn);
+			*buf_mask |= 1u << u.chn;
+			continue;
+		}
+		if (u.src >= UNIFORM_TEX_FFT) {
+			/* audio textures stay bound to their unit */
+			n = u.src - UNIFORM_TEX_FFT;
+			glProgramUniform1i(prog, u.loc, tex_audio[n].unit);
+			*audio_mask |= 1u << n;
+			continue;
+		}
+		(*uniforms)[(*uniform_count)++] = u;
+	}
+	if (verbose)
+		printf("%s: %zu/%d uniforms bound\n", what, *uniform_count, count);
 }
 
 static void
-shader_init(void)
+shader_reflect(struct shader *s)
 {
-	static float quad[] = {
-		0.0, 0.0,
-		0.0, 1.0,
-		1.0, 0.0,
-		1.0, 1.0,
-	};
-	const char *vert =
-		GLSL_VERSION
-		"layout (location = 0) in vec2 a_pos;\n"
-		"out vec2 texcoord;\n"
-		"void main() {\n"
-		"	gl_Position = vec4(a_pos - 0.5, 0.0, 0.5);\n"
-		"	texcoord = a_pos;\n"
-		"}\n";
+	struct pass *p;
+	size_t i;
 
-	glGenVertexArrays(1, &quad_vao);
-	glBindVertexArray(quad_vao);
+	program_reflect(s->prog, s->name, &s->uniforms, &s->uniform_count,
+			&s->audio_mask, &s->buf_mask);
+	for (i = 0; i < PASS_MAX; i++) {
+		p = &s->pass[i];
+		if (!p->prog)
+			continue;
+		program_reflect(p->prog, s->name, &p->uniforms, &p->uniform_count,
+				&p->audio_mask, &p->buf_mask);
+		s->audio_mask |= p->audio_mask;
+	}
+}
 
-	glGenBuffers(1, &quad_vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
-	glBindVertexArray(0);
+static int
+mkdirs(char *path)
+{
+	char *p;
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(path, 0755) && errno != EEXIST) {
+			*p = '/';
+			return 0;
+		}
+		*p = '/';
+	}
+	return !mkdir(path, 0755) || errno == EEXIST;
+}
 
-	vshd = glCreateShader(GL_VERTEX_SHADER);
-	if (!shader_compile(vshd, vert, strlen(vert)))
-		die("error in vertex shader\n");
+static void
+prog_cache_init(void)
+{
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	const GLenum name[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	const char *str;
+	GLint formats = 0;
+	size_t i;
 
-	glEnable(GL_BLEND);
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats < 1)
+		return;
+	if (xdg && *xdg)
+		snprintf(prog_cache.dir, sizeof(prog_cache.dir), "%s/bonz", xdg);
+	else if (home && *home)
+		snprintf(prog_cache.dir, sizeof(prog_cache.dir), "%s/.cache/bonz", home);
+	else
+		return;
+	if (!mkdirs(prog_cache.dir)) {
+		fprintf(stderr, "%s: %s\n", prog_cache.dir, strerror(errno));
+		return;
+	}
 
-	tex_shd = create_2drgb_tex(128, 1 + LEN(shaders) * 128, NULL);
-	glGenFramebuffers(1, &shaders_fbo);
+	prog_cache.driver = HASH64_INIT;
+	for (i = 0; i < LEN(name); i++) {
+		str = (const char *)glGetString(name[i]);
+		if (str)
+			prog_cache.driver = hash64(prog_cache.driver, str, strlen(str) + 1);
+	}
+	prog_cache.on = 1;
+}
+
+static uint64_t
+prog_cache_key(const struct shader_src *src)
+{
+	uint64_t h = hash64(prog_cache.driver, vert_src, strlen(vert_src) + 1);
+	GLsizei i;
+
+	for (i = 0; i < src->count; i++)
+		h = hash64(h, src->str[i], src->len[i]);
+	return h;
 }
 
 static void
-update_cc(GLuint sprg, int loc, unsigned char cc)
+prog_cache_path(char *path, size_t size, uint64_t key)
 {
-	GLenum type;
+	snprintf(path, size, "%s/%016llx", prog_cache.dir, (unsigned long long)key);
+}
 
-	glGetActiveUniform(sprg, loc, 0, NULL, NULL, &type, NULL);
+static GLuint
+prog_cache_load(uint64_t key)
+{
+	char path[sizeof(prog_cache.dir) + 32];
+	char *data = NULL;
+	GLuint prog = 0;
+	GLenum fmt;
+	GLint ok;
+	long size;
+	FILE *f;
+
+	prog_cache_path(path, sizeof(path), key);
+	f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	if (!fseek(f, 0, SEEK_END) && (size = ftell(f)) > (long)sizeof(fmt) &&
+	    !fseek(f, 0, SEEK_SET) && (data = malloc(size)) &&
+	    fread(data, 1, size, f) == (size_t)size) {
+		memcpy(&fmt, data, sizeof(fmt));
+		prog = glCreateProgram();
+		glProgramBinary(prog, fmt, data + sizeof(fmt), size - sizeof(fmt));
+		glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+		if (!ok) {
+			glDeleteProgram(prog);
+			prog = 0;
+		}
+	}
+	fclose(f);
+	free(data);
+	/* stale, after a driver update for instance */
+	if (!prog)
+		unlink(path);
+	return prog;
+}
 
-	if (type == GL_FLOAT)
-		glProgramUniform1f(sprg, loc, cc / 127.0f);
-	else
-		glProgramUniform1ui(sprg, loc, cc);
+static void
+prog_cache_store(GLuint prog, uint64_t key)
+{
+	char path[sizeof(prog_cache.dir) + 32], tmp[sizeof(path) + 16];
+	GLint len = 0;
+	GLenum fmt;
+	char *data;
+	FILE *f;
+	int ok;
+
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &len);
+	if (len <= 0 || !(data = malloc(len)))
+		return;
+	glGetProgramBinary(prog, len, &len, &fmt, data);
+
+	/* written aside then renamed, readers never see half a file */
+	prog_cache_path(path, sizeof(path), key);
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	f = fopen(tmp, "wb");
+	ok = f && fwrite(&fmt, sizeof(fmt), 1, f) == 1 &&
+		fwrite(data, 1, len, f) == (size_t)len;
+	if (f && fclose(f))
+		ok = 0;
+	if (ok && !rename(tmp, path)) {
+		prog_cache.stores++;
+	} else {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (f)
+			unlink(tmp);
+	}
+	free(data);
 }
 
 static void
-input(void)
+include_watch(struct include *inc)
 {
-	SDL_Event e;
-	size_t i;
+	char dir[4096];
 
-	while (SDL_PollEvent(&e)) {
-		switch (e.type) {
-		case SDL_WINDOWEVENT:
-			if (e.window.event == SDL_WINDOWEVENT_CLOSE) {
-				fini();
-				exit(0);
-			}
-			break;
-		case SDL_QUIT:
-			fini();
-			exit(0);
-			break;
-		case SDL_KEYDOWN:
-			switch (e.key.keysym.sym) {
-			case SDLK_TAB:
-				show_gui = !show_gui;
-				break;
-			case SDLK_v:
-				verbose = !verbose;
-				printf("--- %s ---\n", verbose ? "verbose" : "quiet");
-				break;
-			case SDLK_r:
-				for (i = 0; i < shader_count; i++)
-					shader_reload(&shaders[i]);
-				break;
-			case SDLK_p:
-				panic();
-				break;
-			case SDLK_1:
-			case SDLK_2:
-			case SDLK_3:
-			case SDLK_4:
-			case SDLK_5:
-			case SDLK_6:
-			case SDLK_7:
-			case SDLK_8:
-			case SDLK_9:
-			case SDLK_0:
-				i = e.key.keysym.sym - '0';
-				if (i >= shader_count)
-					break;
-				shader = &shaders[i];
-				break;
-			}
-			break;
-		case SDL_KEYUP:
-		case SDL_MOUSEMOTION:
-			xpos = e.motion.x;
-			ypos = e.motion.y;
-			break;
-		case SDL_MOUSEBUTTONDOWN:
-		case SDL_MOUSEBUTTONUP:
-			buttons[e.button.button] = e.button.state;
-			break;
+	if (watch.fd < 0 || inc->wd >= 0)
+		return;
+	path_dir(dir, sizeof(dir), inc->path);
+	inc->wd = inotify_add_watch(watch.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY);
+	if (inc->wd < 0)
+		fprintf(stderr, "inotify_add_watch %s: %s\n", dir, strerror(errno));
+}
+
+/*
+ * Print a compiler log with the source string numbers replaced by the file
+ * names, as in "0:12(3): error" or "0(12) : error" or "ERROR: 0:12: ...".
+ */
+static void
+log_print(FILE *f, const char *log, const char *name)
+{
+	const char *p, *q, *eol, *file;
+	unsigned long id;
+	char *e;
+
+	for (p = log; *p; p = eol) {
+		eol = strchr(p, '\n');
+		eol = eol ? eol + 1 : p + strlen(p);
+		q = p;
+		if (strncmp(q, "ERROR: ", 7) == 0)
+			q += 7;
+		else if (strncmp(q, "WARNING: ", 9) == 0)
+			q += 9;
+		file = NULL;
+		if (*q >= '0' && *q <= '9') {
+			id = strtoul(q, &e, 10);
+			if ((*e == ':' || *e == '(') && e[1] >= '0' && e[1] <= '9')
+				file = include_name(id, name);
 		}
+		if (file)
+			fprintf(f, "%.*s%s%.*s", (int)(q - p), p, file, (int)(eol - e), e);
+		else
+			fprintf(f, "%.*s", (int)(eol - p), p);
+	}
+}
+
+/* the "#pragma buffer A [scale]" lines, scale is 0 for buffers not declared */
+static void
+src_buffers(const char *txt, size_t len, float *scale)
+{
+	const char *p, *eol, *end = txt + len;
+	char word[16], num[32];
+	int i;
+
+	memset(scale, 0, PASS_MAX * sizeof(*scale));
+	for (p = txt; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		p = skip_blank(p, eol);
+		if (p == eol || *p != '#')
+			continue;
+		p = next_word(p + 1, eol, word, sizeof(word));
+		if (strcmp(word, "pragma") != 0)
+			continue;
+		p = next_word(p, eol, word, sizeof(word));
+		if (strcmp(word, "buffer") != 0)
+			continue;
+		p = next_word(p, eol, word, sizeof(word));
+		if (word[0] < 'A' || word[0] >= 'A' + PASS_MAX || word[1] != '\0') {
+			fprintf(stderr, "#pragma buffer: expected A to %c\n", 'A' + PASS_MAX - 1);
+			continue;
+		}
+		i = word[0] - 'A';
+		/* the source is not terminated */
+		p = skip_blank(p, eol);
+		snprintf(num, sizeof(num), "%.*s", (int)MIN(eol - p, (long)sizeof(num) - 1), p);
+		scale[i] = p < eol ? strtod(num, NULL) : 1.0;
+		scale[i] = MAX(1.0 / 64, MIN(scale[i], 1.0));
+	}
+}
+
+/* compile and link one pass, or take it from the program cache */
+static void
+build_prog_start(struct build_prog *bp, const struct shader_src *src)
+{
+	if (prog_cache.on) {
+		bp->key = prog_cache_key(src);
+		bp->prog = prog_cache_load(bp->key);
+		if (bp->prog) {
+			prog_cache.hits++;
+			bp->cached = 1;
+			return;
+		}
+		prog_cache.misses++;
+	}
+
+	bp->fshd = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(bp->fshd, src->count, src->str, src->len);
+	glCompileShader(bp->fshd);
+	bp->prog = glCreateProgram();
+	glAttachShader(bp->prog, vshd);
+	glAttachShader(bp->prog, bp->fshd);
+	if (prog_cache.on)
+		glProgramParameteri(bp->prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(bp->prog);
+}
+
+/* start compiling and linking the source, unless it is the same */
+static int
+shader_build_src(struct build *b, struct shader *s, const char *txt, size_t len, int force)
+{
+	struct text exp = { NULL, 0, 0 };
+	struct shader_src src;
+	const char *str;
+	uint32_t deps = 0;
+	size_t size, i;
+	long version;
+	int ret;
+
+	ret = 0;
+	b->hash = HASH64_INIT;
+	str = txt;
+	size = len;
+	if (src_has_include(txt, len)) {
+		src_preamble(txt, len, &version);
+		pthread_mutex_lock(&includes.lock);
+		str = NULL;
+		if (include_expand(&exp, &b->hash, &deps, s->name, 0, txt, len, version < 330)) {
+			str = exp.p;
+			size = exp.len;
+		}
+		pthread_mutex_unlock(&includes.lock);
+	} else {
+		b->hash = hash64(b->hash, txt, len);
+	}
+	__atomic_store_n(&s->deps, deps, __ATOMIC_RELAXED);
+	if (!str) {
+		compile.failed++;
+		goto out;
+	}
+
+	/* touches and identical rewrites still bump ctime */
+	if (b->hash == s->hash && !force) {
+		compile.unchanged++;
+		if (verbose)
+			printf("%s: unchanged\n", s->name);
+		goto out;
+	}
+
+	ret = 1;
+	src_buffers(str, size, b->scale);
+	for (i = 0; i <= PASS_IMAGE; i++) {
+		if (i < PASS_IMAGE && !b->scale[i])
+			continue;
+		shader_src_compat(&src, str, size, i);
+		build_prog_start(&b->p[i], &src);
+	}
+out:
+	free(exp.p);
+	return ret;
+}
+
+/* read the source, the build works on that copy */
+static int
+shader_build(struct build *b, struct shader *s, int force)
+{
+	size_t len;
+	char *txt;
+	int ret;
+
+	txt = read_file(s->name, &len);
+	if (!txt) {
+		fprintf(stderr, "%s: %s\n", s->name, strerror(errno));
+		return 0;
+	}
+	memset(b, 0, sizeof(*b));
+	ret = shader_build_src(b, s, txt, len, force);
+	free(txt);
+	return ret;
+}
+
+/* without the parallel compile extensions the status queries block instead */
+static int
+shader_build_done(struct build *b)
+{
+	GLint done = GL_TRUE;
+	size_t i;
+
+	for (i = 0; i <= PASS_IMAGE && done; i++) {
+		if (gl_max_shader_compiler_threads && b->p[i].prog)
+			glGetProgramiv(b->p[i].prog, GL_COMPLETION_STATUS_KHR, &done);
+	}
+	return done;
+}
+
+static int
+build_prog_check(struct build_prog *bp, const char *name)
+{
+	GLuint block;
+	GLint ret;
+
+	/* nothing to compile on a cache hit */
+	ret = GL_TRUE;
+	if (bp->fshd)
+		glGetShaderiv(bp->fshd, GL_COMPILE_STATUS, &ret);
+	if (!ret) {
+		glGetShaderInfoLog(bp->fshd, sizeof(logbuf), &logsize, logbuf);
+		fprintf(stderr, "--- ERROR ---\n");
+		log_print(stderr, logbuf, name);
+	} else {
+		glGetProgramiv(bp->prog, GL_LINK_STATUS, &ret);
+		if (!ret) {
+			glGetProgramInfoLog(bp->prog, sizeof(logbuf), &logsize, logbuf);
+			printf("--- ERROR ---\n");
+			log_print(stdout, logbuf, name);
+		}
+	}
+	/* stays attached until the program goes */
+	glDeleteShader(bp->fshd);
+	bp->fshd = 0;
+	if (!ret) {
+		glDeleteProgram(bp->prog);
+		bp->prog = 0;
+		return 0;
+	}
+
+	if (prog_cache.on && !bp->cached)
+		prog_cache_store(bp->prog, bp->key);
+
+	block = glGetUniformBlockIndex(bp->prog, "bonz");
+	if (block != GL_INVALID_INDEX)
+		glUniformBlockBinding(bp->prog, block, BONZ_BINDING);
+	return 1;
+}
+
+/* every pass must build for any of them to be used */
+static int
+shader_build_check(struct build *b, const char *name)
+{
+	size_t i;
+	int ret = 1;
+
+	for (i = 0; i <= PASS_IMAGE; i++) {
+		if (b->p[i].prog && !build_prog_check(&b->p[i], name))
+			ret = 0;
+	}
+	return ret;
+}
+
+static void
+build_free(struct build *b)
+{
+	size_t i;
+
+	if (!b)
+		return;
+	for (i = 0; i <= PASS_IMAGE; i++) {
+		if (b->p[i].fshd)
+			glDeleteShader(b->p[i].fshd);
+		if (b->p[i].prog)
+			glDeleteProgram(b->p[i].prog);
+	}
+	if (b->fence)
+		glDeleteSync(b->fence);
+	free(b);
+}
+
+/* takes the programs out of the build */
+static void
+shader_install(struct shader *s, struct build *b)
+{
+	GLint loc;
+	size_t i;
+
+	if (s->prog)
+		glDeleteProgram(s->prog);
+	s->prog = b->p[PASS_IMAGE].prog;
+	for (i = 0; i < PASS_MAX; i++) {
+		if (s->pass[i].prog)
+			glDeleteProgram(s->pass[i].prog);
+		s->pass[i].prog = b->p[i].prog;
+		s->pass[i].scale = b->scale[i];
+		b->p[i].prog = 0;
+	}
+	b->p[PASS_IMAGE].prog = 0;
+	s->live_timer.count = 0;
+	s->thumb_timer.count = 0;
+	shader_reflect(s);
+
+	/* the attribute is at 0 in every pass, set once in the shared vao */
+	glUseProgram(s->prog);
+	glBindVertexArray(quad_vao);
+
+	loc = glGetAttribLocation(s->prog, "a_pos");
+	if (loc >= 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+		glVertexAttribPointer(loc, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+		glEnableVertexAttribArray(loc);
+		glVertexAttribDivisor(loc, 0);
+	}
+	glBindVertexArray(0);
+	/* keep the benchmark table alone on stdout */
+	if (!offline.bench)
+		printf("--- LOADED --- (%d)\n", s->prog);
+}
+
+/* build and install right away, stalling the caller */
+static void
+shader_reload(struct shader *s, int force)
+{
+	struct build b;
+	size_t i;
+
+	if (!shader_build(&b, s, force))
+		return;
+	if (shader_build_check(&b, s->name)) {
+		s->hash = b.hash;
+		shader_install(s, &b);
+	}
+	/* what a failed check left */
+	for (i = 0; i <= PASS_IMAGE; i++) {
+		if (b.p[i].prog)
+			glDeleteProgram(b.p[i].prog);
+	}
+}
+
+static void
+texture_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < LEN(tex_audio); i++)
+		tex_audio[i] = create_1dr32_tex(FFT_SIZE, NULL);
+	buf_unit = tex_units;
+	tex_units += PASS_MAX;
+
+	glGenBuffers(1, &audio_pbo.pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, audio_pbo.pbo);
+	if (gl_buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		gl_buffer_storage(GL_PIXEL_UNPACK_BUFFER, AUDIO_PBO_SLOTS * AUDIO_PBO_SIZE, NULL, flags);
+		audio_pbo.map = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, AUDIO_PBO_SLOTS * AUDIO_PBO_SIZE, flags);
+	}
+	if (!audio_pbo.map)
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, AUDIO_PBO_SIZE, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (verbose)
+		printf("audio textures: %s\n", audio_pbo.map ? "persistent pbo ring" : "orphaned pbo");
+}
+
+static void
+shader_init(void)
+{
+	static float quad[] = {
+		0.0, 0.0,
+		0.0, 1.0,
+		1.0, 0.0,
+		1.0, 1.0,
+	};
+	glGenVertexArrays(1, &quad_vao);
+	glBindVertexArray(quad_vao);
+
+	glGenBuffers(1, &quad_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+
+	vshd = glCreateShader(GL_VERTEX_SHADER);
+	if (!shader_compile(vshd, vert_src, strlen(vert_src)))
+		die("error in vertex shader\n");
+	prog_cache_init();
+
+	glEnable(GL_BLEND);
+
+	tex_shd = create_2drgb_tex(THUMB_SIZE, 1 + LEN(shaders) * THUMB_SIZE, NULL);
+	glGenFramebuffers(1, &shaders_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, shaders_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_shd.id, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	tex_live = create_tex(GL_TEXTURE_2D);
+	glGenFramebuffers(1, &live_fbo);
+
+	glGenBuffers(1, &bonz_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, bonz_ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(bonz_block), &bonz_block, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, BONZ_BINDING, bonz_ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+static void
+update_bonz_block(int w, int h)
+{
+	size_t c, i, n, lo, hi;
+	uint32_t bits;
+
+	bonz_block.resolution[0] = w;
+	bonz_block.resolution[1] = h;
+	bonz_block.time = get_time() - time_start;
+	bonz_block.buf_scale = live_scale / live_scale_max;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, bonz_ubo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, offsetof(struct bonz_block, cc), &bonz_block);
+
+	/* only upload the span of controllers that moved on each channel */
+	for (c = 0; c < LEN(midi_dirty); c++) {
+		unsigned char *src = c < 16 ? midi_cc[c] : midi_cc_last;
+
+		lo = LEN(bonz_block.cc[c]);
+		hi = 0;
+		for (i = 0; i < LEN(midi_dirty[c]); i++) {
+			bits = __atomic_exchange_n(&midi_dirty[c][i], 0, __ATOMIC_ACQUIRE);
+			while (bits) {
+				n = i * 32 + __builtin_ctz(bits);
+				bits &= bits - 1;
+				bonz_block.cc[c][n] = __atomic_load_n(&src[n], __ATOMIC_RELAXED);
+				lo = MIN(lo, n);
+				hi = MAX(hi, n + 1);
+			}
+		}
+		if (lo < hi) {
+			glBufferSubData(GL_UNIFORM_BUFFER,
+					offsetof(struct bonz_block, cc) + c * LEN(bonz_block.cc[c]) + lo,
+					hi - lo, &bonz_block.cc[c][lo]);
+			cc_stats.uploaded += hi - lo;
+		}
+		cc_stats.skipped += LEN(bonz_block.cc[c]) - (lo < hi ? hi - lo : 0);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+static void
+update_cc(GLuint sprg, struct uniform *u, unsigned char cc)
+{
+	switch (u->type) {
+	case GL_FLOAT:
+		glProgramUniform1f(sprg, u->loc, cc / 127.0f);
+		break;
+	case GL_INT:
+	case GL_BOOL:
+		glProgramUniform1i(sprg, u->loc, cc);
+		break;
+	default:
+		glProgramUniform1ui(sprg, u->loc, cc);
+		break;
+	}
+}
+
+static int
+is_frame_fmt(const char *fmt)
+{
+	int n = 0;
+
+	for (; *fmt; fmt++) {
+		if (*fmt != '%')
+			continue;
+		if (*++fmt == '%')
+			continue;
+		fmt += strspn(fmt, "0123456789-+ #");
+		if (!strchr("diux", *fmt) || !*fmt)
+			return 0;
+		n++;
+	}
+	return n == 1;
+}
+
+static int
+rec_queue_push(struct rec_frame *f)
+{
+	unsigned long pos = rec.push;
+	struct rec_cell *c = &rec.cell[pos % REC_QUEUE_SIZE];
+
+	if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != pos)
+		return 0;
+	c->f = f;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+	rec.push = pos + 1;
+	return 1;
+}
+
+static struct rec_frame *
+rec_queue_pop(void)
+{
+	unsigned long pos = __atomic_load_n(&rec.pop, __ATOMIC_RELAXED);
+	struct rec_cell *c;
+	struct rec_frame *f;
+	long dif;
+
+	for (;;) {
+		c = &rec.cell[pos % REC_QUEUE_SIZE];
+		dif = (long)(__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (dif < 0)
+			return NULL;
+		if (dif == 0 && __atomic_compare_exchange_n(&rec.pop, &pos, pos + 1, 1,
+							   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+		if (dif > 0)
+			pos = __atomic_load_n(&rec.pop, __ATOMIC_RELAXED);
+	}
+	f = c->f;
+	__atomic_store_n(&c->seq, pos + REC_QUEUE_SIZE, __ATOMIC_RELEASE);
+	return f;
+}
+
+static void
+rec_encode(struct rec_frame *f, unsigned char *row)
+{
+	size_t y, stride = 3 * f->w;
+	qoi_desc desc = { f->w, f->h, 3, QOI_SRGB };
+	char path[4096];
+	double t, ms;
+	void *data;
+	FILE *file;
+	int len;
+
+	/* gl rows go bottom-up, qoi top-down */
+	for (y = 0; y < (size_t)f->h / 2; y++) {
+		memcpy(row, f->pix + y * stride, stride);
+		memcpy(f->pix + y * stride, f->pix + (f->h - 1 - y) * stride, stride);
+		memcpy(f->pix + (f->h - 1 - y) * stride, row, stride);
+	}
+
+	t = clock_ms();
+	if (rec.stripes)
+		data = qois_encode(f->pix, &desc, rec.stripes, rec.stripe_threads, &len);
+	else
+		data = qoi_simd_encode(f->pix, &desc, &len);
+	ms = clock_ms() - t;
+
+	pthread_mutex_lock(&rec.lock);
+	rec.encode_count++;
+	rec.encode_ms += ms;
+	rec.encode_max = MAX(rec.encode_max, ms);
+	while (rec.order != f->seq)
+		pthread_cond_wait(&rec.cond, &rec.lock);
+	pthread_mutex_unlock(&rec.lock);
+
+	snprintf(path, sizeof(path), rec.path, f->num);
+	file = data ? fopen(path, "wb") : NULL;
+	if (!file || fwrite(data, 1, len, file) != (size_t)len)
+		fprintf(stderr, "%s: %s\n", path, data ? strerror(errno) : "encode failed");
+	else if (verbose)
+		printf("%s\n", path);
+	if (file)
+		fclose(file);
+	free(data);
+
+	pthread_mutex_lock(&rec.lock);
+	rec.order++;
+	rec.written++;
+	pthread_cond_broadcast(&rec.cond);
+	pthread_mutex_unlock(&rec.lock);
+}
+
+static void *
+rec_worker(void *arg)
+{
+	struct rec_frame *f;
+	unsigned char *row = NULL;
+	size_t row_size = 0;
+
+	(void) arg; /* unused */
+
+	for (;;) {
+		while (sem_wait(&rec.items) && errno == EINTR)
+			;
+		f = rec_queue_pop();
+		sem_post(&rec.space);
+		/* a NULL frame asks one worker to leave */
+		if (!f)
+			break;
+
+		if (row_size < 3 * (size_t)f->w)
+			row = realloc(row, row_size = 3 * f->w);
+		rec_encode(f, row);
+		free(f);
+	}
+	free(row);
+
+	return NULL;
+}
+
+/* returns 0 when the queue is full and the frame was not taken */
+static int
+rec_push(struct rec_frame *f)
+{
+	unsigned long depth;
+
+	if (!f || rec.block) {
+		while (sem_wait(&rec.space) && errno == EINTR)
+			;
+	} else if (sem_trywait(&rec.space)) {
+		return 0;
+	}
+	if (f)
+		f->seq = rec.pushed;
+	if (!rec_queue_push(f)) {
+		sem_post(&rec.space);
+		return 0;
+	}
+	if (f) {
+		rec.pushed++;
+		depth = rec.push - __atomic_load_n(&rec.pop, __ATOMIC_RELAXED);
+		rec.depth_max = MAX(rec.depth_max, depth);
+	}
+	sem_post(&rec.items);
+
+	return 1;
+}
+
+/* map the read back frames whose fence signaled, waiting for up to wait */
+static void
+rec_collect(unsigned int wait)
+{
+	size_t slot, size = 3 * (size_t)rec.w * rec.h;
+	struct rec_frame *f;
+	GLenum ret;
+	void *map;
+
+	while (rec.tail != rec.head) {
+		slot = rec.tail % REC_PBOS;
+		ret = glClientWaitSync(rec.fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT,
+				       wait ? 1000000000 : 0);
+		if (ret == GL_TIMEOUT_EXPIRED)
+			break;
+		if (ret != GL_ALREADY_SIGNALED && wait)
+			wait--;
+		glDeleteSync(rec.fence[slot]);
+		rec.tail++;
+
+		f = malloc(sizeof(*f) + size);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, rec.pbo[slot]);
+		map = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (f && map) {
+			f->num = rec.num[slot];
+			f->w = rec.w;
+			f->h = rec.h;
+			memcpy(f->pix, map, size);
+		}
+		if (map)
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (!f || !map || !rec_push(f)) {
+			free(f);
+			rec.dropped++;
+		}
+	}
+}
+
+static void
+rec_start(void)
+{
+	size_t len = strlen(rec.path);
+	long i, n, ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (!is_frame_fmt(rec.path)) {
+		fprintf(stderr, "%s: expected a single %%d conversion for the frame number\n", rec.path);
+		rec.on = 0;
+		return;
+	}
+	if (!rec.worker_count) {
+		for (i = 0; i < REC_QUEUE_SIZE; i++)
+			rec.cell[i].seq = i;
+		sem_init(&rec.items, 0, 0);
+		sem_init(&rec.space, 0, REC_QUEUE_SIZE);
+
+		/* leave a core to the render thread */
+		n = MAX(1, MIN(ncpu - 1, REC_WORKERS_MAX));
+		for (i = 0; i < n; i++) {
+			if (pthread_create(&rec.worker[i], NULL, rec_worker, NULL))
+				die("pthread_create: %s\n", strerror(errno));
+			rec.worker_count++;
+		}
+	}
+	/* striped frames spread the cores the pool leaves over their stripes */
+	rec.stripes = len > 5 && !strcmp(rec.path + len - 5, ".qois") ? REC_STRIPES : 0;
+	rec.stripe_threads = MAX(1, ncpu / rec.worker_count);
+	rec.on = 1;
+	printf("--- RECORDING --- %s (%d workers)\n", rec.path, rec.worker_count);
+}
+
+static void
+rec_stop(void)
+{
+	if (!rec.on)
+		return;
+	rec_collect(REC_PBOS);
+	rec.on = 0;
+	printf("--- STOPPED --- %lu frames, %lu dropped\n", rec.captured, rec.dropped);
+}
+
+static void
+rec_fini(void)
+{
+	int i;
+
+	rec_stop();
+	for (i = 0; i < rec.worker_count; i++)
+		rec_push(NULL);
+	for (i = 0; i < rec.worker_count; i++)
+		pthread_join(rec.worker[i], NULL);
+	rec.worker_count = 0;
+}
+
+/* start reading back the w x h frame of the current read framebuffer */
+static void
+rec_capture(int w, int h)
+{
+	size_t i, slot;
+
+	if (!rec.pbo[0]) {
+		glGenBuffers(REC_PBOS, rec.pbo);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	}
+	if (w != rec.w || h != rec.h) {
+		rec_collect(REC_PBOS);
+		rec.w = w;
+		rec.h = h;
+		for (i = 0; i < REC_PBOS; i++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, rec.pbo[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, 3 * (size_t)w * h, NULL, GL_STREAM_READ);
+		}
+	}
+
+	rec_collect(0);
+	if (rec.head - rec.tail == REC_PBOS) {
+		if (!rec.block) {
+			rec.dropped++;
+			rec.frame++;
+			return;
+		}
+		/* wait for the oldest one only */
+		rec_collect(1);
+	}
+
+	slot = rec.head % REC_PBOS;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rec.pbo[slot]);
+	glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	rec.fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	rec.num[slot] = rec.frame++;
+	rec.head++;
+	rec.captured++;
+}
+
+static void
+gpu_timer_begin(struct gpu_timer *t)
+{
+	if (!t->query[0])
+		glGenQueries(LEN(t->query), t->query);
+	/* all queries in flight, skip this measurement */
+	t->active = t->head - t->tail < LEN(t->query);
+	if (t->active)
+		glBeginQuery(GL_TIME_ELAPSED, t->query[t->head % LEN(t->query)]);
+}
+
+static void
+gpu_timer_end(struct gpu_timer *t)
+{
+	if (!t->active)
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	t->head++;
+	t->active = 0;
+}
+
+/* returns the number of new results, the latest is in last_ms */
+static int
+gpu_timer_collect(struct gpu_timer *t)
+{
+	GLuint q, avail;
+	GLuint64 ns;
+	int n = 0;
+
+	while (t->tail != t->head) {
+		q = t->query[t->tail % LEN(t->query)];
+		glGetQueryObjectuiv(q, GL_QUERY_RESULT_AVAILABLE, &avail);
+		if (!avail)
+			break;
+		glGetQueryObjectui64v(q, GL_QUERY_RESULT, &ns);
+		t->last_ms = ns / 1e6;
+		t->hist[t->count++ % LEN(t->hist)] = t->last_ms;
+		t->tail++;
+		n++;
+	}
+	return n;
+}
+
+static double
+gpu_timer_avg(struct gpu_timer *t)
+{
+	unsigned int i, n = MIN(t->count, LEN(t->hist));
+	double sum = 0.0;
+
+	for (i = 0; i < n; i++)
+		sum += t->hist[i];
+	return n ? sum / n : 0.0;
+}
+
+static double
+gpu_timer_max(struct gpu_timer *t)
+{
+	unsigned int i, n = MIN(t->count, LEN(t->hist));
+	double max = 0.0;
+
+	for (i = 0; i < n; i++)
+		max = MAX(max, t->hist[i]);
+	return max;
+}
+
+static void
+gpu_timers_collect(void)
+{
+	size_t i;
+
+	for (i = 0; i < shader_count; i++) {
+		gpu_timer_collect(&shaders[i].live_timer);
+		gpu_timer_collect(&shaders[i].thumb_timer);
+	}
+	gpu_timer_collect(&gui_timer);
+}
+
+/*
+ * render thread: after swap number swaps, which returned once the frame of
+ * the swap before was flipped
+ */
+static void
+audio_lat_update(unsigned long swaps, double swapped)
+{
+	uint64_t us = audio_lat.queued_us;
+	int shown = audio_lat.queued + 1 == swaps;
+	double ms;
+
+	audio_lat.queued_us = audio_lat.shown_us;
+	audio_lat.queued = swaps;
+	audio_lat.shown_us = 0;
+	if (!us || !shown)
+		return;
+	if (us == audio_lat.prev_us)
+		audio_lat.repeats++;
+	audio_lat.prev_us = us;
+	ms = MAX(swapped - us / 1e3, 0.0);
+	audio_lat.bin[MIN((size_t)ms, LAT_BINS - 1)]++;
+	audio_lat.ms[audio_lat.count++ % LEN(audio_lat.ms)] = ms;
+	audio_lat.max = MAX(audio_lat.max, ms);
+}
+
+/* upper edge of the bin holding fraction q of the samples */
+static double
+audio_lat_quantile(double q)
+{
+	unsigned long sum = 0;
+	size_t i;
+
+	for (i = 0; i < LAT_BINS - 1; i++) {
+		sum += audio_lat.bin[i];
+		if (sum > q * audio_lat.count)
+			break;
+	}
+	return i + 1;
+}
+
+static void
+stats_dump(void)
+{
+	struct shader *s;
+	size_t i;
+
+	printf("--- STATS ---\n");
+	printf("cc: %lu uploaded, %lu skipped\n", cc_stats.uploaded, cc_stats.skipped);
+	printf("gpu ms (avg/max):\n");
+	for (i = 0; i < shader_count; i++) {
+		s = &shaders[i];
+		printf("%zu %s: live %.3f/%.3f thumb %.3f/%.3f\n", i, s->name,
+		       gpu_timer_avg(&s->live_timer), gpu_timer_max(&s->live_timer),
+		       gpu_timer_avg(&s->thumb_timer), gpu_timer_max(&s->thumb_timer));
+	}
+	printf("gui: %.3f/%.3f\n", gpu_timer_avg(&gui_timer), gpu_timer_max(&gui_timer));
+	printf("graph: %zu targets, %zu KiB, %lu passes drawn, %lu skipped, %lu plans\n",
+	       graph.target_count, graph.bytes >> 10, graph.runs, graph.skips, graph.plans);
+	printf("pace: %s, %.2f ms period, %.2f ms cost, %.2f ms margin, %lu/%lu missed, %lu late\n",
+	       pace.on ? "on" : "off", pace.period, pace.cost, pace.margin,
+	       pace.missed, pace.frames, pace.late);
+	printf("audio: %lu frames, %lu repeated, p50 <%.0f p99 <%.0f max %.1f ms\n",
+	       audio_lat.count, audio_lat.repeats, audio_lat_quantile(0.5),
+	       audio_lat_quantile(0.99), audio_lat.max);
+	for (i = 0; i < LAT_BINS; i++) {
+		if (audio_lat.bin[i])
+			printf(" %2zu%s ms: %lu\n", i, i == LAT_BINS - 1 ? "+" : "", audio_lat.bin[i]);
+	}
+	printf("compile: %lu built, %lu failed, %lu unchanged, %.1f/%.1f ms%s\n",
+	       compile.built, compile.failed, compile.unchanged,
+	       compile.built ? compile.ms / compile.built : 0.0, compile.max_ms,
+	       compile.running ? "" : " (render thread)");
+	printf("cache: %lu hits, %lu misses, %lu stored%s\n", prog_cache.hits, prog_cache.misses,
+	       prog_cache.stores, prog_cache.on ? "" : " (off)");
+	pthread_mutex_lock(&includes.lock);
+	printf("include: %zu files, %lu expanded, %lu cached, %lu changed\n", includes.count,
+	       includes.loads, includes.hits, includes.changes);
+	pthread_mutex_unlock(&includes.lock);
+	printf("watch: %lu events, %lu reloads, %lu unchanged\n",
+	       __atomic_load_n(&watch.events, __ATOMIC_RELAXED),
+	       __atomic_load_n(&watch.reloads, __ATOMIC_RELAXED),
+	       __atomic_load_n(&watch.unchanged, __ATOMIC_RELAXED));
+	printf("events: %lu input, %lu file dropped\n",
+	       __atomic_load_n(&input_queue.dropped, __ATOMIC_RELAXED),
+	       __atomic_load_n(&file_queue.dropped, __ATOMIC_RELAXED));
+	printf("rec: %lu captured, %lu dropped, %lu written\n", rec.captured, rec.dropped, rec.written);
+	pthread_mutex_lock(&rec.lock);
+	printf("rec: queue depth %lu (max %lu/%d), encode %.3f/%.3f ms, %d workers\n",
+	       rec.push - __atomic_load_n(&rec.pop, __ATOMIC_RELAXED), rec.depth_max, REC_QUEUE_SIZE,
+	       rec.encode_count ? rec.encode_ms / rec.encode_count : 0.0, rec.encode_max,
+	       rec.worker_count);
+	pthread_mutex_unlock(&rec.lock);
+}
+
+static int
+evq_push(struct evq *q, const struct event *e)
+{
+	unsigned long tail = q->tail;
+
+	if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) >= EVQ_SIZE) {
+		__atomic_fetch_add(&q->dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+	q->ev[tail % EVQ_SIZE] = *e;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int
+evq_pop(struct evq *q, struct event *e)
+{
+	unsigned long head = q->head;
+
+	if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+		return 0;
+	*e = q->ev[head % EVQ_SIZE];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static void
+compile_finish(size_t i, struct build *b, double start)
+{
+	double ms;
+	size_t j;
+
+	if (!shader_build_check(b, shaders[i].name)) {
+		compile.failed++;
+		build_free(b);
+		return;
+	}
+	shaders[i].hash = b->hash;
+
+	/* first draw, where drivers tend to finish the job */
+	glViewport(0, 0, 1, 1);
+	for (j = 0; j <= PASS_IMAGE; j++) {
+		if (!b->p[j].prog)
+			continue;
+		glUseProgram(b->p[j].prog);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+	b->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+
+	ms = clock_ms() - start;
+	compile.built++;
+	compile.ms += ms;
+	compile.max_ms = MAX(compile.max_ms, ms);
+	if (verbose)
+		printf("%s: built in %.1f ms\n", shaders[i].name, ms);
+	build_free(__atomic_exchange_n(&shaders[i].built, b, __ATOMIC_ACQ_REL));
+}
+
+static void *
+compile_loop(void *arg)
+{
+	struct build *b[LEN(shaders)] = { NULL };
+	double start[LEN(shaders)];
+	struct timespec ts = { 0, 1000000 };
+	struct event e;
+	size_t i, busy = 0;
+
+	(void)arg;
+	if (SDL_GL_MakeCurrent(compile.win, compile.ctx))
+		die("compile: SDL_GL_MakeCurrent: %s\n", SDL_GetError());
+	if (gl_max_shader_compiler_threads)
+		gl_max_shader_compiler_threads(0xffffffff);
+
+	/* vertex arrays and framebuffers are not shared, make our own */
+	glGenVertexArrays(1, &compile.vao);
+	glBindVertexArray(compile.vao);
+	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+	glEnableVertexAttribArray(0);
+	glGenTextures(1, &compile.tex);
+	glBindTexture(GL_TEXTURE_2D, compile.tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glGenFramebuffers(1, &compile.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, compile.fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, compile.tex, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, BONZ_BINDING, bonz_ubo);
+
+	for (;;) {
+		if (!busy)
+			sem_wait(&compile.sem);
+		if (__atomic_load_n(&quit, __ATOMIC_ACQUIRE))
+			break;
+
+		/* start everything queued, the driver may build them in parallel */
+		while (evq_pop(&compile.jobs, &e)) {
+			i = e.key;
+			build_free(b[i]);
+			b[i] = calloc(1, sizeof(*b[i]));
+			if (!b[i] || !shader_build(b[i], &shaders[i], e.x)) {
+				free(b[i]);
+				b[i] = NULL;
+				continue;
+			}
+			start[i] = clock_ms();
+		}
+
+		busy = 0;
+		for (i = 0; i < shader_count; i++) {
+			if (!b[i])
+				continue;
+			if (!shader_build_done(b[i])) {
+				busy++;
+				continue;
+			}
+			compile_finish(i, b[i], start[i]);
+			b[i] = NULL;
+		}
+		if (busy)
+			nanosleep(&ts, NULL);
+	}
+	for (i = 0; i < shader_count; i++)
+		build_free(b[i]);
+	SDL_GL_MakeCurrent(compile.win, NULL);
+	return NULL;
+}
+
+static void
+compile_start(void)
+{
+	if (!compile.ctx)
+		return;
+	sem_init(&compile.sem, 0, 0);
+	if (pthread_create(&compile.thread, NULL, compile_loop, NULL)) {
+		fprintf(stderr, "compile: pthread_create: %s\n", strerror(errno));
+		return;
+	}
+	compile.running = 1;
+}
+
+static void
+compile_stop(void)
+{
+	if (!compile.running)
+		return;
+	sem_post(&compile.sem);
+	pthread_join(compile.thread, NULL);
+	compile.running = 0;
+}
+
+/*
+ * Render thread: rebuild on the compile thread when there is one. Building
+ * here meanwhile would race it on the stats, the log buffer and the hashes,
+ * so a full queue keeps the request for the next frame instead.
+ */
+static void
+shader_request(struct shader *s, int force)
+{
+	struct event e = { EV_RELOAD, s - shaders, 0, 0 };
+
+	if (!compile.running) {
+		shader_reload(s, force);
+		return;
+	}
+	e.x = MAX(force, s->request - 1);
+	s->request = 0;
+	if (evq_push(&compile.jobs, &e))
+		sem_post(&compile.sem);
+	else
+		s->request = 1 + e.x;
+}
+
+/* render thread: swap in the programs whose first draw is done */
+static void
+shader_collect(void)
+{
+	struct shader *s;
+	struct build *b;
+	size_t i;
+
+	for (i = 0; i < shader_count; i++) {
+		s = &shaders[i];
+		b = __atomic_exchange_n(&s->built, NULL, __ATOMIC_ACQ_REL);
+		if (b) {
+			build_free(s->pending);
+			s->pending = b;
+		}
+		if (!s->pending || glClientWaitSync(s->pending->fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			continue;
+		shader_install(s, s->pending);
+		build_free(s->pending);
+		s->pending = NULL;
+	}
+}
+
+/* main thread: translate SDL events for the render thread */
+static void
+events(unsigned int timeout)
+{
+	struct event ev;
+	SDL_Event e;
+
+	if (!SDL_WaitEventTimeout(&e, timeout))
+		return;
+	do {
+		switch (e.type) {
+		case SDL_WINDOWEVENT:
+			if (e.window.event == SDL_WINDOWEVENT_CLOSE)
+				__atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+			break;
+		case SDL_QUIT:
+			__atomic_store_n(&quit, 1, __ATOMIC_RELEASE);
+			break;
+		case SDL_KEYDOWN:
+			ev = (struct event){ EV_KEY, e.key.keysym.sym, 0, 0 };
+			evq_push(&input_queue, &ev);
+			break;
+		case SDL_MOUSEMOTION:
+			ev = (struct event){ EV_MOTION, 0, e.motion.x, e.motion.y };
+			evq_push(&input_queue, &ev);
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			ev = (struct event){ EV_BUTTON, e.button.button, e.button.state, 0 };
+			evq_push(&input_queue, &ev);
+			break;
+		}
+	} while (SDL_PollEvent(&e));
+}
+
+static void
+input(void)
+{
+	struct event e;
+	size_t i;
+
+	while (evq_pop(&input_queue, &e)) {
+		switch (e.type) {
+		case EV_KEY:
+			switch (e.key) {
+			case SDLK_TAB:
+				show_gui = !show_gui;
+				break;
+			case SDLK_h:
+				show_hud = !show_hud;
+				break;
+			case SDLK_v:
+				verbose = !verbose;
+				printf("--- %s ---\n", verbose ? "verbose" : "quiet");
+				break;
+			case SDLK_r:
+				for (i = 0; i < shader_count; i++)
+					shader_request(&shaders[i], 1);
+				break;
+			case SDLK_p:
+				panic();
+				break;
+			case SDLK_s:
+				stats_dump();
+				break;
+			case SDLK_l:
+				pace.on = !pace.on;
+				printf("--- pace %s ---\n", pace.on ? "on" : "off");
+				break;
+			case SDLK_c:
+				if (rec.on)
+					rec_stop();
+				else
+					rec_start();
+				break;
+			case SDLK_1:
+			case SDLK_2:
+			case SDLK_3:
+			case SDLK_4:
+			case SDLK_5:
+			case SDLK_6:
+			case SDLK_7:
+			case SDLK_8:
+			case SDLK_9:
+			case SDLK_0:
+				i = e.key - '0';
+				if (i >= shader_count)
+					break;
+				shader = &shaders[i];
+				break;
+			}
+			break;
+		case EV_MOTION:
+			xpos = e.x;
+			ypos = e.y;
+			break;
+		case EV_BUTTON:
+			if ((size_t)e.key < LEN(buttons))
+				buttons[e.key] = e.x;
+			break;
+		}
+	}
+}
+
+static void
+update_audio(void)
+{
+	unsigned int used = 0;
+	size_t i, base = 0;
+	float *dst = NULL;
+	GLsync *fence = NULL;
+
+	for (i = 0; i < shader_count; i++)
+		used |= shaders[i].audio_mask;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, audio_pbo.pbo);
+	if (used && audio_pbo.map) {
+		fence = &audio_pbo.fence[audio_pbo.slot];
+		base = audio_pbo.slot * AUDIO_TEX_COUNT * FFT_SIZE;
+		audio_pbo.slot = (audio_pbo.slot + 1) % AUDIO_PBO_SLOTS;
+		/* the slot was last read three frames ago, this rarely blocks */
+		if (*fence) {
+			glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			glDeleteSync(*fence);
+			*fence = NULL;
+		}
+		dst = audio_pbo.map + base;
+	} else if (used) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, AUDIO_PBO_SIZE, NULL, GL_STREAM_DRAW);
+		dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, AUDIO_PBO_SIZE,
+				       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	}
+
+	/* snapshot once, every program samples the same units */
+	audio_lat.shown_us = dst ? __atomic_load_n(&audio_lat.capture_us, __ATOMIC_ACQUIRE) : 0;
+	for (i = 0; dst && i < LEN(tex_audio); i++) {
+		if (used & (1u << i))
+			memcpy(dst + i * FFT_SIZE, audio_src[i], FFT_SIZE * sizeof(float));
+	}
+	if (dst && !audio_pbo.map)
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	for (i = 0; i < LEN(tex_audio); i++) {
+		glActiveTexture(GL_TEXTURE0 + tex_audio[i].unit);
+		if (dst && (used & (1u << i))) {
+			void *off = (void *)((base + i * FFT_SIZE) * sizeof(float));
+			update_1dr32_tex(&tex_audio[i], off, FFT_SIZE);
+		} else {
+			glBindTexture(GL_TEXTURE_1D, tex_audio[i].id);
+		}
+	}
+	if (fence)
+		*fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static void
+program_update(GLuint sprg, struct uniform *uniforms, size_t count)
+{
+	struct uniform *u;
+	size_t i;
+
+	/* values not redirected to the bonz block by shader_src_compat() */
+	for (i = 0; i < count; i++) {
+		u = &uniforms[i];
+		switch (u->src) {
+		case UNIFORM_TIME:
+			glProgramUniform1f(sprg, u->loc, bonz_block.time);
+			break;
+		case UNIFORM_RESOLUTION:
+			/* set by render_shader() */
+			break;
+		case UNIFORM_BUF_SCALE:
+			glProgramUniform1f(sprg, u->loc, bonz_block.buf_scale);
+			break;
+		case UNIFORM_CC:
+			update_cc(sprg, u, bonz_block.cc[16][u->num]);
+			break;
+		case UNIFORM_CHAN_CC:
+			update_cc(sprg, u, bonz_block.cc[u->chn][u->num]);
+			break;
+		case UNIFORM_TEX_BUF:
+		case UNIFORM_TEX_FFT:
+		case UNIFORM_TEX_FFT_SMTH:
+		case UNIFORM_TEX_SND:
+			/* never in the table, see program_reflect() */
+			break;
+		}
+	}
+}
+
+static void
+update_shader(struct shader *s)
+{
+	program_update(s->prog, s->uniforms, s->uniform_count);
+}
+
+static void
+program_draw(GLuint prog, struct uniform *uniforms, size_t count, int x, int y, int w, int h)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (uniforms[i].src == UNIFORM_RESOLUTION)
+			glProgramUniform2f(prog, uniforms[i].loc, w, h);
+	}
+
+	glViewport(x, y, w, h);
+	glBindVertexArray(quad_vao);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+static void
+render_shader(struct shader *s, int x, int y, int w, int h)
+{
+	program_draw(s->prog, s->uniforms, s->uniform_count, x, y, w, h);
+}
+
+/* bit per buffer pass declared */
+static unsigned int
+shader_buffers(struct shader *s)
+{
+	unsigned int mask = 0;
+	size_t i;
+
+	for (i = 0; i < PASS_MAX; i++)
+		mask |= (s->pass[i].prog != 0) << i;
+	return mask;
+}
+
+static void
+graph_free(void)
+{
+	struct target *t;
+	size_t i;
+
+	for (i = 0; i < graph.target_count; i++) {
+		t = &graph.target[i];
+		glDeleteFramebuffers(1, &t->fbo);
+		glDeleteTextures(1, &t->tex);
+	}
+	graph.target_count = 0;
+	graph.bytes = 0;
+}
+
+static int
+graph_target(int w, int h)
+{
+	static const GLfloat black[4];
+	struct target *t = &graph.target[graph.target_count];
+
+	t->w = w;
+	t->h = h;
+	glActiveTexture(GL_TEXTURE0 + buf_unit);
+	glGenTextures(1, &t->tex);
+	glBindTexture(GL_TEXTURE_2D, t->tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+	glGenFramebuffers(1, &t->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t->tex, 0);
+	/* feedback starts from black */
+	glClearBufferfv(GL_COLOR, 0, black);
+	graph.bytes += (size_t)w * h * 4 * 2;
+	return graph.target_count++;
+}
+
+/* whether the pass reads time or audio, run every frame */
+static int
+pass_varying(const struct pass *p)
+{
+	size_t i;
+
+	for (i = 0; i < p->uniform_count; i++) {
+		if (p->uniforms[i].src == UNIFORM_TIME)
+			return 1;
+	}
+	return p->audio_mask != 0;
+}
+
+/* the controller values read by the pass */
+static uint64_t
+pass_inputs(const struct pass *p)
+{
+	const struct uniform *u;
+	uint64_t h = HASH64_INIT;
+	size_t i;
+
+	for (i = 0; i < p->uniform_count; i++) {
+		u = &p->uniforms[i];
+		if (u->src == UNIFORM_CC)
+			h = hash64(h, &bonz_block.cc[16][u->num], 1);
+		else if (u->src == UNIFORM_CHAN_CC)
+			h = hash64(h, &bonz_block.cc[u->chn][u->num], 1);
+	}
+	return h;
+}
+
+static void
+graph_plan(struct shader *s, int w, int h)
+{
+	unsigned int self = 0, kept = 0, shared, reads, old, bit;
+	int last[PASS_MAX], owner[TARGET_MAX];
+	int i, j, x, pw, ph;
+	struct pass *p;
+
+	graph_free();
+	graph.shader = s;
+	graph.w = w;
+	graph.h = h;
+	graph.valid = 0;
+	graph.ran = 0;
+	graph.plans++;
+	for (i = 0; i < PASS_MAX; i++) {
+		graph.prog[i] = s->pass[i].prog;
+		graph.cur[i] = graph.prev[i] = -1;
+		last[i] = i;
+	}
+
+	/* read this frame, by itself, or from the frame before */
+	for (i = 0; i <= PASS_IMAGE; i++) {
+		if (i < PASS_IMAGE && !s->pass[i].prog)
+			continue;
+		reads = i < PASS_IMAGE ? s->pass[i].buf_mask : s->buf_mask;
+		for (x = 0; x < PASS_MAX; x++) {
+			if (!(reads & (1u << x)) || !s->pass[x].prog)
+				continue;
+			if (x == i)
+				self |= 1u << x;
+			else if (x > i)
+				kept |= 1u << x;
+			else
+				last[x] = i;
+		}
+	}
+
+	/* time and audio, then whatever reads them */
+	graph.varying = self;
+	for (i = 0; i < PASS_MAX; i++) {
+		if (s->pass[i].prog && pass_varying(&s->pass[i]))
+			graph.varying |= 1u << i;
+	}
+	do {
+		old = graph.varying;
+		for (i = 0; i < PASS_MAX; i++) {
+			if (s->pass[i].buf_mask & graph.varying)
+				graph.varying |= 1u << i;
+		}
+	} while (graph.varying != old);
+
+	/* a target drawn every frame goes back to the pool after its last reader */
+	shared = graph.varying & ~self & ~kept;
+	for (j = 0; j < TARGET_MAX; j++)
+		owner[j] = -1;
+	for (i = 0; i < PASS_MAX; i++) {
+		p = &s->pass[i];
+		bit = 1u << i;
+		if (!p->prog)
+			continue;
+		pw = MAX(1, w * p->scale);
+		ph = MAX(1, h * p->scale);
+		j = graph.target_count;
+		if (shared & bit) {
+			for (j = 0; j < (int)graph.target_count; j++) {
+				x = owner[j];
+				if (x >= 0 && (shared & (1u << x)) && last[x] < i &&
+				    graph.target[j].w == pw && graph.target[j].h == ph)
+					break;
+			}
+		}
+		if (j == (int)graph.target_count)
+			j = graph_target(pw, ph);
+		owner[j] = i;
+		graph.cur[i] = j;
+		if (self & bit)
+			graph.prev[i] = graph_target(pw, ph);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (verbose)
+		printf("graph: %zu targets for %d passes, %zu KiB\n", graph.target_count,
+		       __builtin_popcount(shader_buffers(s)), graph.bytes >> 10);
+}
+
+/* bind the buffers read by pass i, PASS_IMAGE for the image */
+static void
+graph_bind(struct shader *s, int i, unsigned int reads)
+{
+	int x, t;
+
+	for (x = 0; x < PASS_MAX; x++) {
+		if (!(reads & (1u << x)))
+			continue;
+		t = graph.shader == s ? graph.cur[x] : -1;
+		if (x == i)
+			t = graph.prev[x];
+		glActiveTexture(GL_TEXTURE0 + buf_unit + x);
+		glBindTexture(GL_TEXTURE_2D, t >= 0 ? graph.target[t].tex : 0);
 	}
 }
 
+/*
+ * render thread: draw the buffers of s that need it, once a frame, in the
+ * scale part of targets planned for w x h
+ */
 static void
-update_shader(struct shader *s)
+graph_render(struct shader *s, int w, int h, double scale)
 {
-	GLint loc;
-	char cc[] = "cc000";
-	char ccc[] = "c00cc000";
-	int i, j;
-	GLuint sprg = s->prog;
-	float time = get_time() - time_start;
-
-	loc = glGetUniformLocation(sprg, "fGlobalTime");
-	if (loc >= 0)
-		glProgramUniform1f(sprg, loc, time);
-	loc = glGetUniformLocation(sprg, "time");
-	if (loc >= 0)
-		glProgramUniform1f(sprg, loc, time);
-
-	for (i = 0; i < 128; i++) {
-		snprintf(cc, sizeof(cc), "cc%d", i);
-		loc = glGetUniformLocation(sprg, cc);
-		if (loc >= 0)
-			update_cc(sprg, loc, midi_cc_last[i]);
-
-		for (j = 0; j < 16; j++) {
-			snprintf(ccc, sizeof(ccc), "c%dcc%d", j, i);
-			loc = glGetUniformLocation(sprg, ccc);
-			if (loc >= 0)
-				update_cc(sprg, loc, midi_cc[j][i]);
-		}
-	}
-
-	loc = glGetUniformLocation(sprg, "texFFT");
-	if (loc >= 0) {
-		glActiveTexture(GL_TEXTURE0 + tex_fft.unit);
-		update_1dr32_tex(&tex_fft, fftw_out, LEN(fftw_out));
-		glProgramUniform1i(sprg, loc, tex_fft.unit);
+	unsigned int ran = 0, bit, before;
+	int i, tmp, stale;
+	struct target *t;
+	struct pass *p;
+	uint64_t in;
+
+	if (!graph.fresh)
+		return;
+	graph.fresh = 0;
+	stale = graph.shader != s || graph.w != w || graph.h != h;
+	for (i = 0; i < PASS_MAX; i++)
+		stale |= graph.prog[i] != s->pass[i].prog;
+	if (stale)
+		graph_plan(s, w, h);
+	/* the targets are kept, their content is redrawn at the new size */
+	if (graph.scale != scale) {
+		graph.scale = scale;
+		graph.valid = 0;
 	}
 
-	loc = glGetUniformLocation(sprg, "texFFTSmoothed");
-	if (loc >= 0) {
-		glActiveTexture(GL_TEXTURE0 + tex_fft_smth.unit);
-		update_1dr32_tex(&tex_fft_smth, fft_smth, LEN(fft_smth));
-		glProgramUniform1i(sprg, loc, tex_fft_smth.unit);
+	for (i = 0; i < PASS_MAX; i++) {
+		p = &s->pass[i];
+		bit = 1u << i;
+		if (!p->prog)
+			continue;
+		/* passes before drawn in this frame, the others in the last */
+		before = (ran & (bit - 1)) | (graph.ran & ~(bit - 1));
+		in = pass_inputs(p);
+		if (!(graph.varying & bit) && (graph.valid & bit) &&
+		    in == graph.inputs[i] && !(p->buf_mask & before)) {
+			graph.skips++;
+			continue;
+		}
+		if (graph.prev[i] >= 0) {
+			tmp = graph.prev[i];
+			graph.prev[i] = graph.cur[i];
+			graph.cur[i] = tmp;
+		}
+		graph_bind(s, i, p->buf_mask);
+		t = &graph.target[graph.cur[i]];
+		glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+		glUseProgram(p->prog);
+		program_update(p->prog, p->uniforms, p->uniform_count);
+		program_draw(p->prog, p->uniforms, p->uniform_count, 0, 0,
+			     MAX(1, t->w * scale), MAX(1, t->h * scale));
+		graph.inputs[i] = in;
+		graph.valid |= bit;
+		ran |= bit;
+		graph.runs++;
 	}
+	graph.ran = ran;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-	loc = glGetUniformLocation(sprg, "texSND");
-	if (loc >= 0) {
-		glActiveTexture(GL_TEXTURE0 + tex_snd.unit);
-		update_1dr32_tex(&tex_snd, fftw_in, LEN(fftw_in));
-		glProgramUniform1i(sprg, loc, tex_snd.unit);
+static void
+live_scale_update(void)
+{
+	struct gpu_timer *live_timer = &shader->live_timer;
+	double f;
+
+	if (!gpu_timer_collect(live_timer) || live_timer->last_ms <= 0.0)
+		return;
+	/* ignore results still in flight when the scale last changed */
+	if (live_settle) {
+		live_settle--;
+		return;
+	}
+	if (fabs(live_timer->last_ms - live_target_ms) < live_target_ms * live_hysteresis)
+		return;
+
+	/* cost is proportional to the pixel count, ramp up slowly */
+	f = MIN(sqrt(live_target_ms / live_timer->last_ms), 1.1);
+	f = MAX(live_scale_min, MIN(live_scale * f, live_scale_max));
+	if (f != live_scale) {
+		live_scale = f;
+		live_settle = GPU_TIMER_QUERIES;
+		if (verbose)
+			printf("live: %.2f ms, scale %.2f\n", live_timer->last_ms, live_scale);
 	}
 }
 
 static void
-render_shader(struct shader *s, int x, int y, int w, int h)
+live_resize(int w, int h)
 {
-	GLint loc = glGetUniformLocation(s->prog, "v2Resolution");
-	if (loc >= 0)
-		glProgramUniform2f(s->prog, loc, w-x, h-y);
+	w = ceil(w * live_scale_max);
+	h = ceil(h * live_scale_max);
+	if (w == live_w && h == live_h)
+		return;
+	live_w = w;
+	live_h = h;
 
-	glBindVertexArray(quad_vao);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glBindTexture(tex_live.type, tex_live.id);
+	glTexParameteri(tex_live.type, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(tex_live.type, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(tex_live.type, 0, GL_RGB8, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, live_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_live.type, tex_live.id, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static int
+thumb_y(struct shader *s)
+{
+	return 1 + (s - shaders) * THUMB_SIZE;
+}
+
+/* the selected shader's thumbnail is a downscale of the live output */
+static void
+thumb_copy_live(int w, int h)
+{
+	int y = thumb_y(shader);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, live_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shaders_fbo);
+	glBlitFramebuffer(0, 0, w, h, 0, y, THUMB_SIZE, y + THUMB_SIZE,
+			  GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/* refresh the other thumbnails round-robin until thumb_budget is spent */
+static void
+thumb_render(void)
+{
+	struct shader *s;
+	double cost, spent = 0.0;
+	size_t i;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, shaders_fbo);
+	for (i = 0; i < shader_count; i++) {
+		s = &shaders[thumb_next];
+		/* buffers are only drawn live, that thumbnail is copied */
+		if (s == shader || !s->prog || shader_buffers(s)) {
+			thumb_next = (thumb_next + 1) % shader_count;
+			continue;
+		}
+		if (thumb_budget_px)
+			cost = THUMB_SIZE * THUMB_SIZE;
+		else
+			cost = s->thumb_timer.count ? gpu_timer_avg(&s->thumb_timer) : thumb_budget;
+		if (spent > 0.0 && spent + cost > thumb_budget)
+			break;
+		spent += MAX(cost, 1e-3);
+		thumb_next = (thumb_next + 1) % shader_count;
+		glUseProgram(s->prog);
+		update_shader(s);
+		gpu_timer_begin(&s->thumb_timer);
+		render_shader(s, 0, thumb_y(s), THUMB_SIZE, THUMB_SIZE);
+		gpu_timer_end(&s->thumb_timer);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 static void
 render_window(SDL_Window *window)
 {
-	int w, h;
+	int w, h, sw, sh;
 
 	SDL_GL_MakeCurrent(window, gl_ctx);
 	SDL_GL_GetDrawableSize(window, &w, &h);
@@ -474,9 +2803,30 @@ render_window(SDL_Window *window)
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	if (shader->prog) {
+		live_resize(w, h);
+		sw = MAX(1, w * live_scale);
+		sh = MAX(1, h * live_scale);
+
+		gpu_timer_begin(&shader->live_timer);
+		/* buffers are drawn by the first window of the frame */
+		graph_render(shader, live_w, live_h, live_scale / live_scale_max);
+		glBindFramebuffer(GL_FRAMEBUFFER, live_fbo);
 		glUseProgram(shader->prog);
 		update_shader(shader);
-		render_shader(shader, 0, 0, w, h);
+		graph_bind(shader, PASS_IMAGE, shader->buf_mask);
+		render_shader(shader, 0, 0, sw, sh);
+		gpu_timer_end(&shader->live_timer);
+
+		/* upscale to the window */
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, sw, sh, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, w, h);
+
+		if (rec.on && window == win_live)
+			rec_capture(w, h);
+		if (show_gui && window == win_live)
+			thumb_copy_live(sw, sh);
 	}
 }
 
@@ -513,10 +2863,10 @@ init_gui(void)
 		"}\n";
 	const char *file = "ascii.qoi";
 	qoi_desc desc;
-	void *data = qoi_read(file, &desc, 3);
+	void *data = qois_read(file, &desc, 3, 0);
 
 	if (!data)
-		die("%s: qoi_read: %s\n", file, strerror(errno));
+		die("%s: qois_read: %s\n", file, strerror(errno));
 	/* hack: set the first pixel to 0xffffff */
 	memcpy(data, (unsigned char[3]){255,255,255}, 3 * sizeof(char));
 	tex_gui = create_2drgb_tex(desc.width, desc.height, data);
@@ -630,6 +2980,7 @@ gui_draw(int w, int h, GLuint prog, GLuint tex_s,  GLuint tex_c)
 static void
 gui_draw_grid_elem(size_t idx, int px, int py, size_t sz)
 {
+	struct gpu_timer *t;
 	uint8_t col;
 	if (idx < shader_count)
 		col = gui_color(40, 40, 40);
@@ -657,6 +3008,14 @@ gui_draw_grid_elem(size_t idx, int px, int py, size_t sz)
 
 		gui_fill(px, py+sz, FW * strlen(shaders[idx].name), FH, col);
 		gui_text(px, py+sz, shaders[idx].name, gui_color(255, 255, 255));
+
+		t = shaders[idx].live_timer.count ? &shaders[idx].live_timer : &shaders[idx].thumb_timer;
+		if (t->count) {
+			char ms[32];
+			snprintf(ms, sizeof(ms), "%.2f/%.2fms", gpu_timer_avg(t), gpu_timer_max(t));
+			gui_fill(px+sz - FW * strlen(ms), py, FW * strlen(ms), FH, col);
+			gui_text(px+sz - FW * strlen(ms), py, ms, gui_color(255, 255, 255));
+		}
 	}
 }
 
@@ -683,34 +3042,215 @@ gui_view_grid(void)
 	}
 }
 
+static void
+gui_view_hud(void)
+{
+	float sorted[PERF_FRAMES], lat[LAT_FRAMES], hist[LAT_BINS] = { 0 };
+	size_t i, n = MIN(perf.count, LEN(perf.frame));
+	size_t m = MIN(audio_lat.count, LEN(audio_lat.ms));
+	int x = 8, y = 8;
+	float top = 1.0f;
+	double ms;
+
+	for (i = 0, ms = 0.0; i < PERF_STAGES; i++)
+		ms += perf.stage[i];
+	gui_fill(x - 4, y - 4, 2 * PERF_FRAMES + 8, 14 * FH + 138, gui_color(0, 0, 0));
+	gui_printf(x, y, "cpu %.2fms", ms);
+	for (i = 0; i < PERF_STAGES; i++)
+		gui_printf(x, y += FH, " %-8s %6.3f", perf_stage_name[i], perf.stage[i]);
+
+	ms = 0.0;
+	for (i = 0; i < shader_count; i++)
+		ms += shaders[i].thumb_timer.last_ms;
+	gui_printf(x, y += FH + 4, "gpu");
+	gui_printf(x, y += FH, " live     %6.3f x%.2f", shader->live_timer.last_ms, live_scale);
+	gui_printf(x, y += FH, " thumbs   %6.3f", show_gui ? ms : 0.0);
+	gui_printf(x, y += FH, " gui      %6.3f", gui_timer.last_ms);
+
+	if (n) {
+		memcpy(sorted, perf.frame, n * sizeof(*sorted));
+		qsort(sorted, n, sizeof(*sorted), cmp_float);
+		gui_printf(x, y += FH + 4, "fps p50 %.1f p99 %.1f min %.1f",
+			   1e3 / sorted[n / 2], 1e3 / sorted[n * 99 / 100], 1e3 / sorted[n - 1]);
+	}
+	gui_printf(x, y += FH + 4, "pace %s %.1fHz slept %.2f", pace.on ? "on" : "off",
+		   1e3 / pace.period, pace.slept);
+	gui_printf(x, y += FH, " cost %.2f +%.2f missed %lu/%lu", pace.cost, pace.margin,
+		   pace.missed, pace.frames);
+
+	/* frame times, the line marks 60Hz */
+	y += FH + 4;
+	gui_graph(x, y, 2 * PERF_FRAMES, 40, perf.frame, n, perf.count, 1e3 / 30,
+		  gui_color(0, 200, 0));
+	gui_fill(x, y + 20, 2 * PERF_FRAMES, 1, gui_color(200, 0, 0));
+
+	/* audio to photon of the recent frames, one bar per ms */
+	y += 44;
+	if (!m) {
+		gui_printf(x, y, "audio -");
+		return;
+	}
+	memcpy(lat, audio_lat.ms, m * sizeof(*lat));
+	qsort(lat, m, sizeof(*lat), cmp_float);
+	gui_printf(x, y, "audio p50 %.1f p99 %.1f max %.1f", lat[m / 2], lat[m * 99 / 100],
+		   lat[m - 1]);
+	for (i = 0; i < m; i++) {
+		float *bin = &hist[MIN((size_t)lat[i], LAT_BINS - 1)];
+
+		*bin += 1.0f;
+		top = MAX(top, *bin);
+	}
+	gui_graph(x, y + FH + 2, 2 * PERF_FRAMES, 24, hist, LAT_BINS, 0, top,
+		  gui_color(0, 120, 200));
+}
+
+static void
+pace_init(void)
+{
+	SDL_DisplayMode mode;
+
+	pace.period = 1e3 / 60;
+	if (SDL_GetWindowDisplayMode(win_live, &mode) == 0 && mode.refresh_rate > 0)
+		pace.period = 1e3 / mode.refresh_rate;
+	pace.margin = 2.0;
+	/* leave the rest of the frame about a quarter of the refresh,
+	 * 12 ms at 60 Hz */
+	if (!live_target_ms)
+		live_target_ms = pace.period * 0.72;
+}
+
+/* render thread: sleep until the latest start that still makes the next vblank */
+static void
+pace_wait(void)
+{
+	struct timespec ts;
+	double now, wake;
+
+	pace.slept = 0.0;
+	if (!pace.on || pace.vblank <= 0.0)
+		return;
+	now = clock_ms();
+	wake = pace.vblank + pace.period - pace.cost - pace.margin;
+	if (wake <= now) {
+		pace.late++;
+		return;
+	}
+	ts.tv_sec = wake / 1e3;
+	ts.tv_nsec = (wake - ts.tv_sec * 1e3) * 1e6;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+	pace.slept = clock_ms() - now;
+}
+
+/*
+ * render thread: swap once the frame before is done on the gpu, the frame
+ * just drawn is then the only one queued and the swap returns when the one
+ * before is flipped
+ */
+static void
+pace_swap(SDL_Window *window)
+{
+	if (pace.fence) {
+		glClientWaitSync(pace.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(pace.fence);
+	}
+	SDL_GL_SwapWindow(window);
+	pace.swapped = clock_ms();
+	pace.swaps++;
+	pace.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/* count vblanks and adapt the period and margin from the return of a swap */
+static void
+pace_vblank(double t, double cost, double peak)
+{
+	double dt = t - pace.vblank, vblank;
+	long n;
+
+	n = pace.vblank > 0.0 ? lround(dt / pace.period) : 0;
+	if (n < 1) {
+		pace.vblank = t;
+		return;
+	}
+	/* the swap ends some time after the vblank: ending early moves
+	 * the phase, ending late is mostly scheduling noise */
+	vblank = pace.vblank + n * pace.period;
+	pace.vblank = t < vblank ? t : vblank + (t - vblank) * 0.1;
+	pace.frames++;
+	/* follow the actual refresh, off by the clock of the display */
+	if (n == 1 && fabs(dt - pace.period) < pace.period * 0.1)
+		pace.period += (dt - pace.period) * 0.01;
+	if (n > 1) {
+		pace.missed++;
+		/* a cost spike is already in the peak, widen only for a miss
+		 * the cost does not explain */
+		if (pace.on && cost <= peak)
+			pace.margin = MIN(pace.margin * 1.5 + 0.25, PACE_MARGIN_MAX);
+	} else if (pace.on) {
+		pace.margin = MAX(pace.margin - 0.01, PACE_MARGIN_MIN);
+	}
+}
+
+/* render thread: after the swap, adapt the cost and take the swap timed */
+static void
+pace_update(void)
+{
+	double cost, peak = pace.cost;
+	size_t i;
+
+	for (i = 0, cost = 0.0; i < PERF_SWAP; i++)
+		cost += perf.stage[i];
+	cost += shader->live_timer.last_ms;
+	if (show_gui || show_hud)
+		cost += gui_timer.last_ms;
+	for (i = 0; show_gui && i < shader_count; i++)
+		cost += shaders[i].thumb_timer.last_ms;
+	if (cost > pace.cost)
+		pace.cost = cost;
+	else
+		pace.cost += (cost - pace.cost) * 0.05;
+
+	pace_vblank(pace.swapped, cost, peak);
+}
+
 static void
 render(void)
 {
 	int w, h;
 
+	live_scale_update();
+	gpu_timers_collect();
+	SDL_GL_GetDrawableSize(win_live, &w, &h);
+	update_bonz_block(w * live_scale, h * live_scale);
+	update_audio();
+	graph.fresh = 1;
+	perf_mark(PERF_UNIFORMS);
+
 #ifndef SINGLE_WIN
 	render_window(win_live);
 	SDL_GL_SwapWindow(win_live);
 #endif
 
-	glBindFramebuffer(GL_FRAMEBUFFER, shaders_fbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_shd.id, 0);
-	for (size_t i = 0; i < shader_count; i++) {
-		glUseProgram(shaders[i].prog);
-		update_shader(&shaders[i]);
-		render_shader(&shaders[i], 0, 1 + i * 128, 128, 128);
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (show_gui)
+		thumb_render();
 
 	render_window(win_ctrl);
 
-	if (show_gui) {
+	if (show_gui || show_hud) {
 		gui_begin(&gui_state);
-		gui_view_grid();
+		if (show_gui)
+			gui_view_grid();
+		if (show_hud)
+			gui_view_hud();
 		SDL_GL_GetDrawableSize(win_ctrl, &w, &h);
+		gpu_timer_begin(&gui_timer);
 		gui_draw(w, h, gui_prg, tex_gui.id, tex_shd.id);
+		gpu_timer_end(&gui_timer);
 	}
-	SDL_GL_SwapWindow(win_ctrl);
+	perf_mark(PERF_DRAW);
+	pace_swap(win_ctrl);
+	perf_mark(PERF_SWAP);
+	audio_lat_update(pace.swaps, pace.swapped);
 }
 
 static void
@@ -728,8 +3268,10 @@ midi_process(size_t size, unsigned char *buff)
 		ccc = buff[0] % 16;
 		ccn = buff[1] % 128;
 		ccv = buff[2];
-		midi_cc[ccc][ccn] = ccv;
-		midi_cc_last[ccn] = ccv;
+		__atomic_store_n(&midi_cc[ccc][ccn], ccv, __ATOMIC_RELAXED);
+		__atomic_store_n(&midi_cc_last[ccn], ccv, __ATOMIC_RELAXED);
+		midi_mark(ccc, ccn);
+		midi_mark(16, ccn);
 		if (verbose)
 			printf("c%dcc%d = %d\n", ccc, ccn, ccv);
 	} else if (sts == 0xf) {
@@ -751,6 +3293,7 @@ jack_process(jack_nframes_t frames, void *arg)
 	jack_midi_event_t event;
 	jack_default_audio_sample_t *in;
 	size_t size = sizeof(jack_default_audio_sample_t);
+	jack_time_t now, start;
 	int r;
 
 	(void) arg; /* unused */
@@ -781,6 +3324,14 @@ jack_process(jack_nframes_t frames, void *arg)
 			fftwf_execute(plan);
 		for (i = 0; i < LEN(fft_smth); i++)
 			fft_smth[i] =  mix(fftw_out[i], fft_smth[i], smth_fac);
+
+		/* the cycle starts once the period ending with the newest
+		 * sample is captured, convert its start to the monotonic clock */
+		now = jack_get_time();
+		start = jack_frames_to_time(jack, jack_last_frame_time(jack));
+		__atomic_store_n(&audio_lat.capture_us,
+				 (uint64_t)(clock_ms() * 1e3) - (now > start ? now - start : 0),
+				 __ATOMIC_RELEASE);
 	}
 
 	return 0;
@@ -848,6 +3399,198 @@ jack_init(void)
 	}
 }
 
+static int
+hash_file(const char *name, uint64_t *hash)
+{
+	uint64_t h = HASH64_INIT;
+	char buf[4096];
+	ssize_t n;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		h = hash64(h, buf, n);
+	close(fd);
+	if (n < 0)
+		return 0;
+	*hash = h;
+	return 1;
+}
+
+/*
+ * Drop the expansions pulling in include i and queue a reload of the
+ * shaders using it, with the lock held. Returns 0 on a full queue.
+ */
+static int
+include_changed(size_t i)
+{
+	struct event e = { EV_RELOAD, 0, 0, 0 };
+	uint32_t bit = 1u << i;
+	size_t j;
+	int ret = 1;
+
+	includes.changes++;
+	for (j = 0; j < includes.count; j++) {
+		if (includes.file[j].deps & bit) {
+			free(includes.file[j].text);
+			includes.file[j].text = NULL;
+		}
+	}
+	for (j = 0; j < shader_count; j++) {
+		if (!(__atomic_load_n(&shaders[j].deps, __ATOMIC_RELAXED) & bit))
+			continue;
+		e.key = j;
+		if (!evq_push(&file_queue, &e))
+			ret = 0;
+	}
+	return ret;
+}
+
+static void
+watch_queue(size_t i)
+{
+	struct event e = { EV_RELOAD, i, 0, 0 };
+	uint64_t h;
+
+	/* gone in the middle of a save, the rename will bring it back */
+	if (!hash_file(shaders[i].name, &h))
+		return;
+	if (h == watch.hash[i]) {
+		__atomic_fetch_add(&watch.unchanged, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (!evq_push(&file_queue, &e)) {
+		watch.due[i] = clock_ms() + WATCH_DEBOUNCE_MS;
+		return;
+	}
+	watch.hash[i] = h;
+	__atomic_fetch_add(&watch.reloads, 1, __ATOMIC_RELAXED);
+}
+
+static void
+watch_read(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	double due = clock_ms() + WATCH_DEBOUNCE_MS;
+	struct include *inc;
+	ssize_t n;
+	char *p;
+	size_t i;
+
+	while ((n = read(watch.fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			__atomic_fetch_add(&watch.events, 1, __ATOMIC_RELAXED);
+			for (i = 0; i < shader_count; i++) {
+				if ((ev->mask & IN_Q_OVERFLOW) ||
+				    (ev->wd == watch.wd[i] && ev->len &&
+				     strcmp(ev->name, path_base(shaders[i].name)) == 0))
+					watch.due[i] = due;
+			}
+			pthread_mutex_lock(&includes.lock);
+			for (i = 0; i < includes.count; i++) {
+				inc = &includes.file[i];
+				if ((ev->mask & IN_Q_OVERFLOW) ||
+				    (ev->wd == inc->wd && ev->len &&
+				     strcmp(ev->name, path_base(inc->path)) == 0))
+					inc->due = due;
+			}
+			pthread_mutex_unlock(&includes.lock);
+		}
+	}
+}
+
+static void *
+watch_loop(void *arg)
+{
+	struct pollfd pfd = { 0, POLLIN, 0 };
+	struct include *inc;
+	double now, next;
+	size_t i;
+
+	(void)arg;
+	pfd.fd = watch.fd;
+	while (!__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+		now = clock_ms();
+		next = now + POLL_MS;
+		for (i = 0; i < shader_count; i++) {
+			if (watch.due[i] > 0 && watch.due[i] <= now) {
+				watch.due[i] = 0;
+				watch_queue(i);
+			}
+			if (watch.due[i] > 0)
+				next = MIN(next, watch.due[i]);
+		}
+		pthread_mutex_lock(&includes.lock);
+		for (i = 0; i < includes.count; i++) {
+			inc = &includes.file[i];
+			if (inc->due > 0 && inc->due <= now)
+				inc->due = include_changed(i) ? 0 : now + WATCH_DEBOUNCE_MS;
+			if (inc->due > 0)
+				next = MIN(next, inc->due);
+		}
+		pthread_mutex_unlock(&includes.lock);
+		if (poll(&pfd, 1, MAX(0, (int)(next - now) + 1)) > 0)
+			watch_read();
+	}
+	return NULL;
+}
+
+/* returns 0 when inotify is unavailable and the files must be polled */
+static int
+watch_start(void)
+{
+	char dir[4096];
+	size_t i;
+	int fd;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "inotify_init1: %s\n", strerror(errno));
+		return 0;
+	}
+	/* includes seen from now on are watched as they come */
+	pthread_mutex_lock(&includes.lock);
+	watch.fd = fd;
+	for (i = 0; i < includes.count; i++)
+		include_watch(&includes.file[i]);
+	pthread_mutex_unlock(&includes.lock);
+	for (i = 0; i < shader_count; i++) {
+		path_dir(dir, sizeof(dir), shaders[i].name);
+		watch.wd[i] = inotify_add_watch(watch.fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY);
+		if (watch.wd[i] < 0) {
+			fprintf(stderr, "inotify_add_watch %s: %s\n", dir, strerror(errno));
+			break;
+		}
+		/* the first load goes through the watcher as well */
+		watch.due[i] = clock_ms();
+	}
+	if (i < shader_count || pthread_create(&watch.thread, NULL, watch_loop, NULL)) {
+		pthread_mutex_lock(&includes.lock);
+		watch.fd = -1;
+		pthread_mutex_unlock(&includes.lock);
+		close(fd);
+		return 0;
+	}
+	return 1;
+}
+
+static void
+watch_stop(void)
+{
+	if (watch.fd < 0)
+		return;
+	pthread_join(watch.thread, NULL);
+	close(watch.fd);
+	pthread_mutex_lock(&includes.lock);
+	watch.fd = -1;
+	pthread_mutex_unlock(&includes.lock);
+}
+
+/* fallback without inotify */
 static void
 shader_poll(struct shader *s)
 {
@@ -863,9 +3606,92 @@ shader_poll(struct shader *s)
 	}
 
 	if (s->time != sb.st_ctime) {
-		s->time = sb.st_ctime;
-		shader_reload(s);
+		struct event e = { EV_RELOAD, s - shaders, 0, 0 };
+
+		/* on a full queue, try again on the next poll */
+		if (evq_push(&file_queue, &e))
+			s->time = sb.st_ctime;
+	}
+}
+
+/* fallback without inotify */
+static void
+include_poll(void)
+{
+	struct include *inc;
+	struct stat sb;
+	size_t i;
+
+	pthread_mutex_lock(&includes.lock);
+	for (i = 0; i < includes.count; i++) {
+		inc = &includes.file[i];
+		if (stat(inc->path, &sb) < 0 || inc->time == sb.st_ctime)
+			continue;
+		/* on a full queue, try again on the next poll */
+		if (include_changed(i))
+			inc->time = sb.st_ctime;
+	}
+	pthread_mutex_unlock(&includes.lock);
+}
+
+/* render thread: reload the shaders the main thread saw change */
+static void
+shader_reloads(void)
+{
+	struct event e;
+	size_t i;
+
+	for (i = 0; i < shader_count; i++) {
+		if (shaders[i].request)
+			shader_request(&shaders[i], shaders[i].request - 1);
+	}
+	while (evq_pop(&file_queue, &e))
+		shader_request(&shaders[e.key], 0);
+	shader_collect();
+}
+
+static void *
+render_loop(void *arg)
+{
+	(void)arg;
+	if (SDL_GL_MakeCurrent(win_live, gl_ctx))
+		die("SDL_GL_MakeCurrent: %s\n", SDL_GetError());
+	while (!__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+		pace_wait();
+		perf_begin();
+		input();
+		perf_mark(PERF_INPUT);
+		shader_reloads();
+		perf_mark(PERF_POLL);
+		render();
+		pace_update();
+	}
+	SDL_GL_MakeCurrent(win_live, NULL);
+	return NULL;
+}
+
+static int
+gl_has_ext(const char *name)
+{
+	GLint i, n = 0;
+
+	glGetIntegerv(GL_NUM_EXTENSIONS, &n);
+	for (i = 0; i < n; i++) {
+		if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+			return 1;
 	}
+	return 0;
+}
+
+static void
+gl_ext_init(GLADloadproc load)
+{
+	if (gl_has_ext("GL_ARB_buffer_storage"))
+		*(void **)&gl_buffer_storage = load("glBufferStorage");
+	if (gl_has_ext("GL_KHR_parallel_shader_compile"))
+		*(void **)&gl_max_shader_compiler_threads = load("glMaxShaderCompilerThreadsKHR");
+	else if (gl_has_ext("GL_ARB_parallel_shader_compile"))
+		*(void **)&gl_max_shader_compiler_threads = load("glMaxShaderCompilerThreadsARB");
 }
 
 static void
@@ -899,6 +3725,7 @@ sdl_gl_init(void)
 
 	if (!gladLoadGLLoader((GLADloadproc) SDL_GL_GetProcAddress))
 		die("GL init failed\n");
+	gl_ext_init((GLADloadproc) SDL_GL_GetProcAddress);
 
 	win_live = window;
 #if SINGLE_WIN
@@ -908,12 +3735,200 @@ sdl_gl_init(void)
 				    default_width, default_height,
 				    SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
 #endif
+
+	/* shared context for the compile thread, reloads stall without it */
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+	compile.win = SDL_CreateWindow("compile", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+				       1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (compile.win)
+		compile.ctx = SDL_GL_CreateContext(compile.win);
+	if (!compile.ctx)
+		fprintf(stderr, "compile context: %s\n", SDL_GetError());
+	SDL_GL_MakeCurrent(window, gl_ctx);
+}
+
+static int
+egl_has_ext(EGLDisplay dpy, const char *name)
+{
+	const char *exts = eglQueryString(dpy, EGL_EXTENSIONS);
+	size_t len = strlen(name);
+
+	for (; exts && (exts = strstr(exts, name)); exts += len) {
+		if (exts[len] == ' ' || exts[len] == '\0')
+			return 1;
+	}
+	return 0;
+}
+
+/* GL context without any window, surfaceless when the driver allows it */
+static void
+egl_init(void)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = NULL;
+	EGLDisplay dpy = EGL_NO_DISPLAY;
+	EGLSurface surf = EGL_NO_SURFACE;
+	EGLContext ctx;
+	EGLConfig cfg;
+	EGLint n;
+	static const EGLint cfg_attr[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	static const EGLint ctx_attr[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 0,
+		EGL_NONE
+	};
+	static const EGLint pbuf_attr[] = {
+		EGL_WIDTH, 16,
+		EGL_HEIGHT, 16,
+		EGL_NONE
+	};
+
+	if (egl_has_ext(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless"))
+		get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display)
+		dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (dpy == EGL_NO_DISPLAY)
+		dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, NULL, NULL))
+		die("EGL init failed: 0x%x\n", eglGetError());
+
+	if (!eglBindAPI(EGL_OPENGL_API))
+		die("EGL: no desktop GL: 0x%x\n", eglGetError());
+	if (!eglChooseConfig(dpy, cfg_attr, &cfg, 1, &n) || n < 1)
+		die("EGL: no matching config: 0x%x\n", eglGetError());
+	ctx = eglCreateContext(dpy, cfg, EGL_NO_CONTEXT, ctx_attr);
+	if (ctx == EGL_NO_CONTEXT)
+		die("EGL: failed to create GL context: 0x%x\n", eglGetError());
+
+	if (!egl_has_ext(dpy, "EGL_KHR_surfaceless_context")) {
+		surf = eglCreatePbufferSurface(dpy, cfg, pbuf_attr);
+		if (surf == EGL_NO_SURFACE)
+			die("EGL: failed to create pbuffer: 0x%x\n", eglGetError());
+	}
+	if (!eglMakeCurrent(dpy, surf, surf, ctx))
+		die("EGL: make current failed: 0x%x\n", eglGetError());
+
+	if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress))
+		die("GL init failed\n");
+	gl_ext_init((GLADloadproc) eglGetProcAddress);
+}
+
+static void
+offline_init(void)
+{
+	egl_init();
+	time_start = 0;
+	shader_init();
+	texture_init();
+	live_scale = live_scale_max = 1.0;
+}
+
+static void
+offline_frame(int w, int h)
+{
+	update_bonz_block(w, h);
+	update_audio();
+	graph.fresh = 1;
+	graph_render(shader, w, h, 1.0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, live_fbo);
+	glUseProgram(shader->prog);
+	update_shader(shader);
+	graph_bind(shader, PASS_IMAGE, shader->buf_mask);
+	render_shader(shader, 0, 0, w, h);
+}
+
+static void
+offline_run(void)
+{
+	int w = offline.size[0][0], h = offline.size[0][1];
+
+	if (!is_frame_fmt(offline.path))
+		die("%s: expected a single %%d conversion for the frame number\n", offline.path);
+	offline_init();
+	shader_reload(shader, 0);
+	if (!shader->prog)
+		die("%s: failed to load\n", shader->name);
+	live_resize(w, h);
+
+	rec.path = offline.path;
+	rec.block = 1;
+	rec_start();
+	for (offline.frame = 0; offline.frame < offline.frames; offline.frame++) {
+		offline_frame(w, h);
+		rec_capture(w, h);
+	}
+	rec_fini();
+}
+
+/*
+ * Time every shader for a fixed number of frames at each size, waiting
+ * for the gpu after each frame, and print one tab separated line per
+ * shader and size. Returns the number of shaders that failed to load.
+ */
+static int
+bench_run(void)
+{
+	float *ms;
+	double t, sum, pix;
+	unsigned int i, n = offline.frames;
+	size_t j;
+	int w, h, failed = 0;
+
+	ms = malloc(n * sizeof(*ms));
+	if (!ms)
+		die("malloc: %s\n", strerror(errno));
+
+	offline_init();
+	printf("shader\twidth\theight\tframes\tmean_ms\tp50_ms\tp99_ms\tmax_ms\tmpix_per_s\n");
+	for (j = 0; j < shader_count; j++) {
+		shader = &shaders[j];
+		shader_reload(shader, 0);
+		if (!shader->prog) {
+			fprintf(stderr, "%s: failed to load\n", shader->name);
+			failed++;
+			continue;
+		}
+		for (i = 0; i < offline.size_count; i++) {
+			w = offline.size[i][0];
+			h = offline.size[i][1];
+			live_resize(w, h);
+
+			/* warm up, the first frames include driver compilation */
+			for (offline.frame = 0; offline.frame < 3; offline.frame++)
+				offline_frame(w, h);
+			glFinish();
+
+			for (sum = 0.0, offline.frame = 0; offline.frame < n; offline.frame++) {
+				t = clock_ms();
+				offline_frame(w, h);
+				glFinish();
+				ms[offline.frame] = clock_ms() - t;
+				sum += ms[offline.frame];
+			}
+			qsort(ms, n, sizeof(*ms), cmp_float);
+			pix = (double)w * h * n / (sum / 1e3);
+			printf("%s\t%d\t%d\t%u\t%.3f\t%.3f\t%.3f\t%.3f\t%.2f\n",
+			       shader->name, w, h, n, sum / n, ms[n / 2], ms[n * 99 / 100],
+			       ms[n - 1], pix / 1e6);
+			fflush(stdout);
+		}
+	}
+	free(ms);
+	return failed;
 }
 
 static void
 init(void)
 {
 	sdl_gl_init();
+	pace_init();
 	time_start = get_time();
 
 	jack_init();
@@ -925,16 +3940,28 @@ init(void)
 static void
 fini(void)
 {
+	rec_fini();
 	jack_fini();
 }
 
 static void
 usage(void)
 {
-	printf("usage: %s <shader_file>\n", argv0);
+	printf("usage: %s [-v] [--pace] [--thumb-budget <n>ms|<n>px] [--record <out%%05d.qoi[s]>]\n"
+	       "       [--scale <min>:<max>] [--target <n>ms] [--hysteresis <f>]\n"
+	       "       [--render <out%%05d.qoi[s]> | --bench]\n"
+	       "       [--fps <n>] [--frames <n>] [--size <w>x<h>]... <shader_file>...\n", argv0);
 	exit(1);
 }
 
+static const char *
+opt_arg(int argc, char **argv, size_t *i)
+{
+	if ((int)++*i >= argc)
+		usage();
+	return argv[*i];
+}
+
 static int
 is_file(const char *file)
 {
@@ -959,6 +3986,7 @@ is_file(const char *file)
 int
 main(int argc, char **argv)
 {
+	double t;
 	size_t i;
 
 	argv0 = argv[0];
@@ -967,21 +3995,122 @@ main(int argc, char **argv)
 		usage();
 
 	for (i = 1; (int)i < argc && shader_count < LEN(shaders); i++) {
-		if (!is_file(argv[i]))
-			die("%s: is not a regular file\n", argv[i]);
-		shaders[shader_count++].name = argv[i];
+		if (strcmp(argv[i], "-v") == 0) {
+			verbose = 1;
+		} else if (strcmp(argv[i], "--render") == 0) {
+			offline.path = opt_arg(argc, argv, &i);
+		} else if (strcmp(argv[i], "--record") == 0) {
+			rec.path = opt_arg(argc, argv, &i);
+			rec.on = 1;
+		} else if (strcmp(argv[i], "--pace") == 0) {
+			pace.on = 1;
+		} else if (strcmp(argv[i], "--thumb-budget") == 0) {
+			const char *arg = opt_arg(argc, argv, &i);
+			char *end;
+
+			thumb_budget = strtod(arg, &end);
+			if (end == arg || thumb_budget <= 0.0)
+				usage();
+			if (strcmp(end, "px") == 0)
+				thumb_budget_px = 1;
+			else if (*end && strcmp(end, "ms") != 0)
+				usage();
+		} else if (strcmp(argv[i], "--scale") == 0) {
+			if (sscanf(opt_arg(argc, argv, &i), "%lf:%lf",
+				   &live_scale_min, &live_scale_max) != 2)
+				usage();
+			if (live_scale_min <= 0.0 || live_scale_min > live_scale_max ||
+			    live_scale_max > 1.0)
+				usage();
+			live_scale = live_scale_max;
+		} else if (strcmp(argv[i], "--target") == 0) {
+			const char *arg = opt_arg(argc, argv, &i);
+			char *end;
+
+			live_target_ms = strtod(arg, &end);
+			if (end == arg || live_target_ms <= 0.0 || (*end && strcmp(end, "ms") != 0))
+				usage();
+		} else if (strcmp(argv[i], "--hysteresis") == 0) {
+			const char *arg = opt_arg(argc, argv, &i);
+			char *end;
+
+			live_hysteresis = strtod(arg, &end);
+			if (end == arg || *end || live_hysteresis < 0.0 || live_hysteresis >= 1.0)
+				usage();
+		} else if (strcmp(argv[i], "--bench") == 0) {
+			offline.bench = 1;
+		} else if (strcmp(argv[i], "--fps") == 0) {
+			offline.fps = strtoul(opt_arg(argc, argv, &i), NULL, 10);
+		} else if (strcmp(argv[i], "--frames") == 0) {
+			offline.frames = strtoul(opt_arg(argc, argv, &i), NULL, 10);
+		} else if (strcmp(argv[i], "--size") == 0) {
+			unsigned int *size = offline.size[offline.size_count];
+
+			if (offline.size_count >= LEN(offline.size))
+				usage();
+			if (sscanf(opt_arg(argc, argv, &i), "%ux%u", &size[0], &size[1]) != 2)
+				usage();
+			if (!size[0] || !size[1])
+				usage();
+			offline.size_count++;
+		} else {
+			if (!is_file(argv[i]))
+				die("%s: is not a regular file\n", argv[i]);
+			shaders[shader_count++].name = argv[i];
+		}
 	}
+	if (shader_count == 0)
+		usage();
 	shader = &shaders[0];
 
+	if (offline.size_count == 0) {
+		offline.size[0][0] = 1920;
+		offline.size[0][1] = 1080;
+		offline.size_count = 1;
+	}
+	if (offline.bench) {
+		if (!offline.fps)
+			usage();
+		if (!offline.frames)
+			offline.frames = 100;
+		i = bench_run();
+		fini();
+		return i != 0;
+	}
+	if (offline.path) {
+		if (!offline.fps || !offline.frames)
+			usage();
+		offline_run();
+		fini();
+		return 0;
+	}
+
 	plan = fftwf_plan_r2r_1d(FFT_SIZE, fftw_in, fftw_out, FFTW_REDFT10, FFTW_MEASURE);
 
 	init();
-	while (1) {
-		input();
-		for (i = 0; i < shader_count; i++)
-			shader_poll(&shaders[i]);
-		render();
+	if (rec.on)
+		rec_start();
+
+	/* hand the context over to the render thread */
+	SDL_GL_MakeCurrent(win_live, NULL);
+	compile_start();
+	if (pthread_create(&render_thread, NULL, render_loop, NULL))
+		die("pthread_create: %s\n", strerror(errno));
+	watch_start();
+	t = 0;
+	while (!__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+		if (watch.fd < 0 && clock_ms() - t >= POLL_MS) {
+			t = clock_ms();
+			for (i = 0; i < shader_count; i++)
+				shader_poll(&shaders[i]);
+			include_poll();
+		}
+		events(POLL_MS);
 	}
+	pthread_join(render_thread, NULL);
+	compile_stop();
+	watch_stop();
+	SDL_GL_MakeCurrent(win_live, gl_ctx);
 	fini();
 
 	return 0;
@@ -8,12 +8,12 @@ PREFIX := /usr/local
 MANPREFIX := $(PREFIX)/share/man
 
 # Depencies includes and libs
-INCS := `pkg-config --cflags sdl2 jack fftw3f`
-LIBS := `pkg-config --libs sdl2 jack fftw3f`
+INCS := `pkg-config --cflags sdl2 jack fftw3f egl`
+LIBS := `pkg-config --libs sdl2 jack fftw3f egl`
 
 # Flags
 CFLAGS ?= -std=c99 -pedantic -march=native -D_XOPEN_SOURCE=500 -D_POSIX_C_SOURCE=200112L
 CFLAGS += -Wall -Wextra -O2 -g
 CFLAGS += $(INCS) -DVERSION=\"$(VERSION)\"
 
-LDFLAGS += $(LIBS) -ldl
+LDFLAGS += $(LIBS) -ldl -lm -lpthread
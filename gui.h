@@ -7,6 +7,8 @@ void gui_draw(int w, int h, GLuint prog, GLuint tex_s,  GLuint tex_c);
 void gui_text(int x, int y, const char *s, uint8_t col);
 uint8_t gui_color(uint8_t r, uint8_t g, uint8_t b);
 void gui_fill(int x, int y, unsigned int w, unsigned int h, uint8_t c);
+void gui_graph(int x, int y, unsigned int w, unsigned int h,
+	       const float *v, size_t n, size_t first, float max, uint8_t c);
 
 struct gui_rect {
 	int16_t x, y;
@@ -203,6 +205,30 @@ gui_fill(int x, int y, unsigned int w, unsigned int h, uint8_t c)
 		  gui_rect(c, 0, 0, 0));
 }
 
+/*
+ * Bar graph of n values read from the ring v starting at index first,
+ * scaled so that max fills the height. Each bar is a plain fill, so the
+ * whole graph ends up in the same instanced draw as the rest of the gui.
+ */
+void
+gui_graph(int x, int y, unsigned int w, unsigned int h,
+	  const float *v, size_t n, size_t first, float max, uint8_t c)
+{
+	unsigned int bw = n ? w / n : 0;
+	unsigned int bh;
+	size_t i;
+	float f;
+
+	if (bw == 0)
+		bw = 1;
+	for (i = 0; i < n && i * bw < w; i++) {
+		f = v[(first + i) % n] / max;
+		bh = (f < 1.0f ? f : 1.0f) * h;
+		if (bh > 0)
+			gui_fill(x + i * bw, y + h - bh, bw, bh, c);
+	}
+}
+
 uint8_t
 gui_color(uint8_t r, uint8_t g, uint8_t b)
 {
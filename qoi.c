@@ -1,2 +1,6 @@
 #define QOI_IMPLEMENTATION
 #include "qoi.h"
+#define QOI_SIMD_IMPLEMENTATION
+#include "qoi_simd.h"
+#define QOIS_IMPLEMENTATION
+#include "qois.h"
@@ -0,0 +1,776 @@
+/*
+ * Vectorised qoi encoder and decoder, producing the exact same bytes and
+ * pixels as the reference implementation in qoi.h.
+ *
+ * The qoi stream is inherently serial (run length and color index depend
+ * on every previous pixel), so only the data parallel parts are vectorised:
+ * the encoder classifies a block of pixels at once (run detection against
+ * the previous pixel, color hash, diff/luma fit and their encoded bytes),
+ * then a short scalar loop emits the chunks; the decoder fills runs and
+ * converts rgba to rgb with vector stores.
+ *
+ * SSE2 and AVX2 paths are selected at runtime, everything else falls back
+ * to plain C. Include after qoi.h; define QOI_SIMD_IMPLEMENTATION in the same
+ * file as, and after, QOI_IMPLEMENTATION.
+ */
+#ifndef QOI_SIMD_H
+#define QOI_SIMD_H
+
+#include <stddef.h>
+
+enum qoi_simd_level {
+	QOI_SIMD_SCALAR,
+	QOI_SIMD_SSE2,
+	QOI_SIMD_AVX2,
+};
+
+int qoi_simd_level(void);
+int qoi_simd_force(int level);
+const char *qoi_simd_name(int level);
+void *qoi_simd_encode(const void *data, const qoi_desc *desc, int *out_len);
+void *qoi_simd_decode(const void *data, int size, qoi_desc *desc, int channels);
+int qoi_simd_decode_to(const void *data, int size, qoi_desc *desc, int channels,
+		       void *out, size_t out_len);
+int qoi_simd_write(const char *filename, const void *data, const qoi_desc *desc);
+void *qoi_simd_read(const char *filename, qoi_desc *desc, int channels);
+
+#endif /* QOI_SIMD_H */
+
+#ifdef QOI_SIMD_IMPLEMENTATION
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define QOI_SIMD_X86
+#include <immintrin.h>
+#define QOI_SIMD_AVX2_FN __attribute__((target("avx2")))
+#endif
+
+/* pixels classified per batch, one bit each in the run mask */
+#define QOI_SIMD_BLOCK 64
+
+/* per pixel classification: class | byte1 << 8 | byte2 << 16 | hash << 24 */
+enum {
+	QOI_SIMD_OP_RGBA,
+	QOI_SIMD_OP_RGB,
+	QOI_SIMD_OP_LUMA,
+	QOI_SIMD_OP_DIFF,
+};
+
+struct qoi_simd_ops {
+	int level;
+	void (*classify)(const unsigned int *px, unsigned int prev, int n,
+			 unsigned int *op, uint64_t *eq);
+	void (*expand)(const unsigned char *in, int n, int last, unsigned int *px);
+	void (*compact)(const unsigned int *px, int n, unsigned char *out);
+	void (*fill)(unsigned int *px, unsigned int v, int n);
+};
+
+static unsigned int
+qoi_simd_op(unsigned int v, unsigned int prev)
+{
+	qoi_rgba_t px, pp;
+	unsigned int hash, op;
+
+	px.v = v;
+	pp.v = prev;
+	hash = QOI_COLOR_HASH(px) % 64;
+	if (px.rgba.a != pp.rgba.a) {
+		op = QOI_SIMD_OP_RGBA;
+	} else {
+		signed char vr = px.rgba.r - pp.rgba.r;
+		signed char vg = px.rgba.g - pp.rgba.g;
+		signed char vb = px.rgba.b - pp.rgba.b;
+		signed char vg_r = vr - vg;
+		signed char vg_b = vb - vg;
+
+		if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+			op = QOI_SIMD_OP_DIFF |
+			     (QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2)) << 8;
+		else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
+			 vg_b > -9 && vg_b < 8)
+			op = QOI_SIMD_OP_LUMA |
+			     (QOI_OP_LUMA | (vg + 32)) << 8 |
+			     ((vg_r + 8) << 4 | (vg_b + 8)) << 16;
+		else
+			op = QOI_SIMD_OP_RGB;
+	}
+	return op | hash << 24;
+}
+
+static void
+qoi_simd_classify_c(const unsigned int *px, unsigned int prev, int n,
+		    unsigned int *op, uint64_t *eq)
+{
+	uint64_t m = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		unsigned int p = i ? px[i - 1] : prev;
+
+		if (px[i] == p)
+			m |= (uint64_t)1 << i;
+		else
+			op[i] = qoi_simd_op(px[i], p);
+	}
+	*eq = m;
+}
+
+static void
+qoi_simd_expand_c(const unsigned char *in, int n, int last, unsigned int *px)
+{
+	qoi_rgba_t c;
+	int i;
+
+	(void)last;
+	c.rgba.a = 255;
+	for (i = 0; i < n; i++, in += 3) {
+		c.rgba.r = in[0];
+		c.rgba.g = in[1];
+		c.rgba.b = in[2];
+		px[i] = c.v;
+	}
+}
+
+static void
+qoi_simd_compact_c(const unsigned int *px, int n, unsigned char *out)
+{
+	qoi_rgba_t c;
+	int i;
+
+	for (i = 0; i < n; i++, out += 3) {
+		c.v = px[i];
+		out[0] = c.rgba.r;
+		out[1] = c.rgba.g;
+		out[2] = c.rgba.b;
+	}
+}
+
+static void
+qoi_simd_fill_c(unsigned int *px, unsigned int v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		px[i] = v;
+}
+
+#ifdef QOI_SIMD_X86
+/*
+ * The vector paths work on the little endian rgba word:
+ * r | g << 8 | b << 16 | a << 24.
+ */
+
+/* rgb to rgba with one unaligned 4 byte load per pixel; last is set when
+ * fewer than 3 pixels follow, and the final pixel then stays in bounds */
+static void
+qoi_simd_expand_x86(const unsigned char *in, int n, int last, unsigned int *px)
+{
+	int i, m = last ? n - 1 : n;
+
+	for (i = 0; i < m; i++) {
+		unsigned int v;
+
+		memcpy(&v, in + 3 * i, 4);
+		px[i] = v | 0xff000000;
+	}
+	if (m < n)
+		qoi_simd_expand_c(in + 3 * m, 1, 0, px + m);
+}
+
+/* rgba to rgb with overlapping 4 byte stores, same trick backwards */
+static void
+qoi_simd_compact_x86(const unsigned int *px, int n, unsigned char *out)
+{
+	int i;
+
+	for (i = 0; i < n - 1; i++)
+		memcpy(out + 3 * i, px + i, 4);
+	if (n > 0)
+		qoi_simd_compact_c(px + n - 1, 1, out + 3 * (n - 1));
+}
+
+/* returns class | byte1 << 8 | byte2 << 16 | hash << 24 for 4 pixels */
+static __m128i
+qoi_simd_op_sse2(__m128i cur, __m128i prv)
+{
+	const __m128i b8 = _mm_set1_epi32(0xff);
+	const __m128i rb = _mm_set1_epi32(0x00ff00ff);
+	__m128i hash, d, t, dg, vgr, vgb, vg, l, a_eq, diff, luma;
+	__m128i op_diff, op_luma, op;
+
+	hash = _mm_add_epi32(
+		_mm_madd_epi16(_mm_and_si128(cur, rb), _mm_set1_epi32(7 << 16 | 3)),
+		_mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(cur, 8), rb),
+			       _mm_set1_epi32(11 << 16 | 5)));
+	hash = _mm_slli_epi32(_mm_and_si128(hash, _mm_set1_epi32(63)), 24);
+
+	d = _mm_sub_epi8(cur, prv);
+	a_eq = _mm_cmpeq_epi32(_mm_srli_epi32(d, 24), _mm_setzero_si128());
+
+	/* diff: every channel in -2..1, biased by 2 */
+	t = _mm_add_epi8(d, _mm_set1_epi32(0x020202));
+	diff = _mm_cmpeq_epi32(_mm_and_si128(t, _mm_set1_epi32(0xfcfcfc)),
+			       _mm_setzero_si128());
+	op_diff = _mm_or_si128(
+		_mm_or_si128(_mm_slli_epi32(_mm_and_si128(t, _mm_set1_epi32(3)), 12),
+			     _mm_and_si128(_mm_slli_epi32(t, 2), _mm_set1_epi32(3 << 10))),
+		_mm_or_si128(_mm_and_si128(_mm_srli_epi32(t, 8), _mm_set1_epi32(3 << 8)),
+			     _mm_set1_epi32(QOI_OP_DIFF << 8 | QOI_SIMD_OP_DIFF)));
+
+	/* luma: green in -32..31, red and blue relative to green in -8..7 */
+	dg = _mm_srli_epi32(d, 8);
+	vg = _mm_and_si128(_mm_add_epi8(dg, _mm_set1_epi32(32)), b8);
+	vgr = _mm_and_si128(_mm_add_epi8(_mm_sub_epi8(d, dg), _mm_set1_epi32(8)), b8);
+	vgb = _mm_and_si128(_mm_add_epi8(_mm_sub_epi8(_mm_srli_epi32(d, 16), dg),
+					 _mm_set1_epi32(8)), b8);
+	l = _mm_or_si128(vg, _mm_or_si128(_mm_slli_epi32(vgr, 8), _mm_slli_epi32(vgb, 16)));
+	luma = _mm_cmpeq_epi32(_mm_and_si128(l, _mm_set1_epi32(0xf0f0c0)),
+			       _mm_setzero_si128());
+	op_luma = _mm_or_si128(
+		_mm_or_si128(_mm_slli_epi32(vg, 8), _mm_slli_epi32(vgr, 20)),
+		_mm_or_si128(_mm_slli_epi32(vgb, 16),
+			     _mm_set1_epi32(QOI_OP_LUMA << 8 | QOI_SIMD_OP_LUMA)));
+
+	/* diff wins over luma wins over rgb, all of them need equal alpha */
+	op = _mm_or_si128(_mm_and_si128(luma, op_luma),
+			  _mm_andnot_si128(luma, _mm_set1_epi32(QOI_SIMD_OP_RGB)));
+	op = _mm_or_si128(_mm_and_si128(diff, op_diff), _mm_andnot_si128(diff, op));
+	op = _mm_and_si128(a_eq, op);
+	return _mm_or_si128(op, hash);
+}
+
+static void
+qoi_simd_classify_sse2(const unsigned int *px, unsigned int prev, int n,
+		       unsigned int *op, uint64_t *eq)
+{
+	uint64_t m = 0, tail;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i cur = _mm_loadu_si128((const __m128i *)(px + i));
+		__m128i prv = _mm_or_si128(_mm_slli_si128(cur, 4),
+					   _mm_cvtsi32_si128(i ? px[i - 1] : prev));
+
+		m |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(cur, prv))) << i;
+		_mm_storeu_si128((__m128i *)(op + i), qoi_simd_op_sse2(cur, prv));
+	}
+	if (i < n) {
+		qoi_simd_classify_c(px + i, i ? px[i - 1] : prev, n - i, op + i, &tail);
+		m |= tail << i;
+	}
+	*eq = m;
+}
+
+static void
+qoi_simd_fill_sse2(unsigned int *px, unsigned int v, int n)
+{
+	__m128i c = _mm_set1_epi32(v);
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i *)(px + i), c);
+	for (; i < n; i++)
+		px[i] = v;
+}
+
+QOI_SIMD_AVX2_FN static __m256i
+qoi_simd_op_avx2(__m256i cur, __m256i prv)
+{
+	const __m256i b8 = _mm256_set1_epi32(0xff);
+	const __m256i rb = _mm256_set1_epi32(0x00ff00ff);
+	__m256i hash, d, t, dg, vgr, vgb, vg, l, a_eq, diff, luma;
+	__m256i op_diff, op_luma, op;
+
+	hash = _mm256_add_epi32(
+		_mm256_madd_epi16(_mm256_and_si256(cur, rb), _mm256_set1_epi32(7 << 16 | 3)),
+		_mm256_madd_epi16(_mm256_and_si256(_mm256_srli_epi32(cur, 8), rb),
+				  _mm256_set1_epi32(11 << 16 | 5)));
+	hash = _mm256_slli_epi32(_mm256_and_si256(hash, _mm256_set1_epi32(63)), 24);
+
+	d = _mm256_sub_epi8(cur, prv);
+	a_eq = _mm256_cmpeq_epi32(_mm256_srli_epi32(d, 24), _mm256_setzero_si256());
+
+	t = _mm256_add_epi8(d, _mm256_set1_epi32(0x020202));
+	diff = _mm256_cmpeq_epi32(_mm256_and_si256(t, _mm256_set1_epi32(0xfcfcfc)),
+				  _mm256_setzero_si256());
+	op_diff = _mm256_or_si256(
+		_mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(t, _mm256_set1_epi32(3)), 12),
+				_mm256_and_si256(_mm256_slli_epi32(t, 2), _mm256_set1_epi32(3 << 10))),
+		_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(t, 8), _mm256_set1_epi32(3 << 8)),
+				_mm256_set1_epi32(QOI_OP_DIFF << 8 | QOI_SIMD_OP_DIFF)));
+
+	dg = _mm256_srli_epi32(d, 8);
+	vg = _mm256_and_si256(_mm256_add_epi8(dg, _mm256_set1_epi32(32)), b8);
+	vgr = _mm256_and_si256(_mm256_add_epi8(_mm256_sub_epi8(d, dg),
+					       _mm256_set1_epi32(8)), b8);
+	vgb = _mm256_and_si256(_mm256_add_epi8(_mm256_sub_epi8(_mm256_srli_epi32(d, 16), dg),
+					       _mm256_set1_epi32(8)), b8);
+	l = _mm256_or_si256(vg, _mm256_or_si256(_mm256_slli_epi32(vgr, 8),
+						_mm256_slli_epi32(vgb, 16)));
+	luma = _mm256_cmpeq_epi32(_mm256_and_si256(l, _mm256_set1_epi32(0xf0f0c0)),
+				  _mm256_setzero_si256());
+	op_luma = _mm256_or_si256(
+		_mm256_or_si256(_mm256_slli_epi32(vg, 8), _mm256_slli_epi32(vgr, 20)),
+		_mm256_or_si256(_mm256_slli_epi32(vgb, 16),
+				_mm256_set1_epi32(QOI_OP_LUMA << 8 | QOI_SIMD_OP_LUMA)));
+
+	op = _mm256_blendv_epi8(_mm256_set1_epi32(QOI_SIMD_OP_RGB), op_luma, luma);
+	op = _mm256_blendv_epi8(op, op_diff, diff);
+	op = _mm256_and_si256(a_eq, op);
+	return _mm256_or_si256(op, hash);
+}
+
+QOI_SIMD_AVX2_FN static void
+qoi_simd_classify_avx2(const unsigned int *px, unsigned int prev, int n,
+		       unsigned int *op, uint64_t *eq)
+{
+	const __m256i rot = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);
+	uint64_t m = 0, tail;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i cur = _mm256_loadu_si256((const __m256i *)(px + i));
+		__m256i prv = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(cur, rot),
+						 _mm256_set1_epi32(i ? px[i - 1] : prev), 1);
+
+		m |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(
+			_mm256_cmpeq_epi32(cur, prv))) << i;
+		_mm256_storeu_si256((__m256i *)(op + i), qoi_simd_op_avx2(cur, prv));
+	}
+	if (i < n) {
+		qoi_simd_classify_c(px + i, i ? px[i - 1] : prev, n - i, op + i, &tail);
+		m |= tail << i;
+	}
+	*eq = m;
+}
+
+/* 8 rgb pixels are 24 bytes: load 32, move bytes 12..27 into the high
+ * lane and spread the first 12 bytes of each lane into 4 words */
+QOI_SIMD_AVX2_FN static void
+qoi_simd_expand_avx2(const unsigned char *in, int n, int last, unsigned int *px)
+{
+	const __m256i perm = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+	const __m256i shuf = _mm256_setr_epi8(
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m256i alpha = _mm256_set1_epi32(0xff000000);
+	int i, m = last ? n - 3 : n;
+
+	for (i = 0; i + 8 <= m; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(in + 3 * i));
+
+		v = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(v, perm), shuf);
+		_mm256_storeu_si256((__m256i *)(px + i), _mm256_or_si256(v, alpha));
+	}
+	qoi_simd_expand_x86(in + 3 * i, n - i, last, px + i);
+}
+
+QOI_SIMD_AVX2_FN static void
+qoi_simd_compact_avx2(const unsigned int *px, int n, unsigned char *out)
+{
+	const __m256i shuf = _mm256_setr_epi8(
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	const __m256i perm = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(px + i));
+
+		v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, shuf), perm);
+		_mm_storeu_si128((__m128i *)(out + 3 * i), _mm256_castsi256_si128(v));
+		_mm_storel_epi64((__m128i *)(out + 3 * i + 16), _mm256_extracti128_si256(v, 1));
+	}
+	qoi_simd_compact_x86(px + i, n - i, out + 3 * i);
+}
+
+QOI_SIMD_AVX2_FN static void
+qoi_simd_fill_avx2(unsigned int *px, unsigned int v, int n)
+{
+	__m256i c = _mm256_set1_epi32(v);
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm256_storeu_si256((__m256i *)(px + i), c);
+	for (; i < n; i++)
+		px[i] = v;
+}
+#endif /* QOI_SIMD_X86 */
+
+static const struct qoi_simd_ops qoi_simd_table[] = {
+	{ QOI_SIMD_SCALAR, qoi_simd_classify_c, qoi_simd_expand_c,
+	  qoi_simd_compact_c, qoi_simd_fill_c },
+#ifdef QOI_SIMD_X86
+	{ QOI_SIMD_SSE2, qoi_simd_classify_sse2, qoi_simd_expand_x86,
+	  qoi_simd_compact_x86, qoi_simd_fill_sse2 },
+	{ QOI_SIMD_AVX2, qoi_simd_classify_avx2, qoi_simd_expand_avx2,
+	  qoi_simd_compact_avx2, qoi_simd_fill_avx2 },
+#endif
+};
+
+static const struct qoi_simd_ops *qoi_simd;
+
+static int
+qoi_simd_detect(void)
+{
+#ifdef QOI_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return QOI_SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return QOI_SIMD_SSE2;
+#endif
+	return QOI_SIMD_SCALAR;
+}
+
+static const struct qoi_simd_ops *
+qoi_simd_get(void)
+{
+	const struct qoi_simd_ops *ops = __atomic_load_n(&qoi_simd, __ATOMIC_ACQUIRE);
+
+	if (!ops) {
+		ops = &qoi_simd_table[qoi_simd_detect()];
+		__atomic_store_n(&qoi_simd, ops, __ATOMIC_RELEASE);
+	}
+	return ops;
+}
+
+int
+qoi_simd_level(void)
+{
+	return qoi_simd_get()->level;
+}
+
+/* select a lower path, mostly for benchmarks; returns the level in use */
+int
+qoi_simd_force(int level)
+{
+	int max = qoi_simd_detect();
+
+	if (level < 0 || level > max)
+		level = max;
+	__atomic_store_n(&qoi_simd, &qoi_simd_table[level], __ATOMIC_RELEASE);
+	return level;
+}
+
+const char *
+qoi_simd_name(int level)
+{
+	switch (level) {
+	case QOI_SIMD_SSE2: return "sse2";
+	case QOI_SIMD_AVX2: return "avx2";
+	default:            return "scalar";
+	}
+}
+
+void *
+qoi_simd_encode(const void *data, const qoi_desc *desc, int *out_len)
+{
+	const struct qoi_simd_ops *ops = qoi_simd_get();
+	unsigned int blk[QOI_SIMD_BLOCK], op[QOI_SIMD_BLOCK];
+	const unsigned char *pixels;
+	qoi_rgba_t index[64], px;
+	unsigned int prev;
+	unsigned char *bytes;
+	int i, n, p, run, max_size, px_count, px_pos, channels, repeats = 0;
+	uint64_t eq;
+
+	if (data == NULL || out_len == NULL || desc == NULL ||
+	    desc->width == 0 || desc->height == 0 ||
+	    desc->channels < 3 || desc->channels > 4 ||
+	    desc->colorspace > 1 ||
+	    desc->height >= QOI_PIXELS_MAX / desc->width)
+		return NULL;
+
+	max_size = desc->width * desc->height * (desc->channels + 1) +
+		QOI_HEADER_SIZE + sizeof(qoi_padding);
+	p = 0;
+	bytes = (unsigned char *) QOI_MALLOC(max_size);
+	if (!bytes)
+		return NULL;
+
+	qoi_write_32(bytes, &p, QOI_MAGIC);
+	qoi_write_32(bytes, &p, desc->width);
+	qoi_write_32(bytes, &p, desc->height);
+	bytes[p++] = desc->channels;
+	bytes[p++] = desc->colorspace;
+
+	pixels = (const unsigned char *)data;
+	channels = desc->channels;
+	px_count = desc->width * desc->height;
+	QOI_ZEROARR(index);
+	px.rgba.r = px.rgba.g = px.rgba.b = 0;
+	px.rgba.a = 255;
+	prev = px.v;
+	run = 0;
+
+	for (px_pos = 0; px_pos < px_count; px_pos += n) {
+		const unsigned int *src = blk;
+
+		n = px_count - px_pos;
+		if (n > QOI_SIMD_BLOCK)
+			n = QOI_SIMD_BLOCK;
+		/* the caller's buffer has no alignment, copy rather than cast */
+		if (channels == 4)
+			memcpy(blk, pixels + 4 * px_pos, 4 * n);
+		else
+			ops->expand(pixels + 3 * px_pos, n, px_count - px_pos - n < 3, blk);
+
+		/* the vector classify computes every pixel while the scalar
+		 * one skips repeats, which wins on flat areas: follow the
+		 * previous block */
+		if (repeats > n - QOI_SIMD_BLOCK / 8)
+			qoi_simd_classify_c(src, prev, n, op, &eq);
+		else
+			ops->classify(src, prev, n, op, &eq);
+		repeats = __builtin_popcountll(eq);
+
+		for (i = 0; i < n; i++) {
+			unsigned int h;
+
+			if (eq >> i & 1) {
+				uint64_t ne = ~(eq >> i);
+				int k = ne ? __builtin_ctzll(ne) : 64 - i;
+
+				/* a whole run of repeats at once, capped to 62 */
+				if (k > n - i)
+					k = n - i;
+				for (run += k; run >= 62; run -= 62)
+					bytes[p++] = QOI_OP_RUN | 61;
+				i += k - 1;
+				continue;
+			}
+			if (run > 0) {
+				bytes[p++] = QOI_OP_RUN | (run - 1);
+				run = 0;
+			}
+
+			px.v = src[i];
+			h = op[i] >> 24;
+			if (index[h].v == px.v) {
+				bytes[p++] = QOI_OP_INDEX | h;
+				continue;
+			}
+			index[h] = px;
+			switch (op[i] & 0xff) {
+			case QOI_SIMD_OP_DIFF:
+				bytes[p++] = op[i] >> 8;
+				break;
+			case QOI_SIMD_OP_LUMA:
+				bytes[p++] = op[i] >> 8;
+				bytes[p++] = op[i] >> 16;
+				break;
+			case QOI_SIMD_OP_RGB:
+				bytes[p++] = QOI_OP_RGB;
+				bytes[p++] = px.rgba.r;
+				bytes[p++] = px.rgba.g;
+				bytes[p++] = px.rgba.b;
+				break;
+			default:
+				bytes[p++] = QOI_OP_RGBA;
+				bytes[p++] = px.rgba.r;
+				bytes[p++] = px.rgba.g;
+				bytes[p++] = px.rgba.b;
+				bytes[p++] = px.rgba.a;
+				break;
+			}
+		}
+		prev = src[n - 1];
+	}
+	if (run > 0)
+		bytes[p++] = QOI_OP_RUN | (run - 1);
+
+	for (i = 0; i < (int)sizeof(qoi_padding); i++)
+		bytes[p++] = qoi_padding[i];
+
+	*out_len = p;
+	return bytes;
+}
+
+static int
+qoi_simd_header(const unsigned char *bytes, int size, qoi_desc *desc)
+{
+	unsigned int header_magic;
+	int p = 0;
+
+	if (bytes == NULL || desc == NULL ||
+	    size < QOI_HEADER_SIZE + (int)sizeof(qoi_padding))
+		return 0;
+
+	header_magic = qoi_read_32(bytes, &p);
+	desc->width = qoi_read_32(bytes, &p);
+	desc->height = qoi_read_32(bytes, &p);
+	desc->channels = bytes[p++];
+	desc->colorspace = bytes[p++];
+
+	return desc->width != 0 && desc->height != 0 &&
+		desc->channels >= 3 && desc->channels <= 4 &&
+		desc->colorspace <= 1 &&
+		header_magic == QOI_MAGIC &&
+		desc->height < QOI_PIXELS_MAX / desc->width;
+}
+
+/* decode into a caller provided buffer of at least width * height * channels
+ * bytes, returns 0 if the header is invalid or the buffer too small */
+int
+qoi_simd_decode_to(const void *data, int size, qoi_desc *desc, int channels,
+		   void *out, size_t out_len)
+{
+	const struct qoi_simd_ops *ops = qoi_simd_get();
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned char *pixels = (unsigned char *)out;
+	unsigned int blk[QOI_SIMD_BLOCK];
+	qoi_rgba_t index[64], px;
+	int i, n, px_count, px_pos, chunks_len;
+	int p = QOI_HEADER_SIZE, run = 0;
+
+	if ((channels != 0 && channels != 3 && channels != 4) ||
+	    !qoi_simd_header(bytes, size, desc))
+		return 0;
+
+	if (channels == 0)
+		channels = desc->channels;
+
+	px_count = desc->width * desc->height;
+	if (pixels == NULL || out_len < (size_t)px_count * channels)
+		return 0;
+
+	QOI_ZEROARR(index);
+	px.rgba.r = px.rgba.g = px.rgba.b = 0;
+	px.rgba.a = 255;
+
+	chunks_len = size - (int)sizeof(qoi_padding);
+	for (px_pos = 0; px_pos < px_count; px_pos += n) {
+		n = px_count - px_pos;
+		if (n > QOI_SIMD_BLOCK)
+			n = QOI_SIMD_BLOCK;
+
+		for (i = 0; i < n;) {
+			int b1;
+
+			if (run > 0 || p >= chunks_len) {
+				int k = p >= chunks_len ? n - i : run;
+
+				if (k > n - i)
+					k = n - i;
+				ops->fill(blk + i, px.v, k);
+				if (run > 0)
+					run -= k;
+				i += k;
+				continue;
+			}
+
+			b1 = bytes[p++];
+			if (b1 == QOI_OP_RGB) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+			} else if (b1 == QOI_OP_RGBA) {
+				px.rgba.r = bytes[p++];
+				px.rgba.g = bytes[p++];
+				px.rgba.b = bytes[p++];
+				px.rgba.a = bytes[p++];
+			} else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+				px = index[b1];
+			} else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+				px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+				px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+				px.rgba.b += ( b1       & 0x03) - 2;
+			} else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+				int b2 = bytes[p++];
+				int vg = (b1 & 0x3f) - 32;
+
+				px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+				px.rgba.g += vg;
+				px.rgba.b += vg - 8 +  (b2       & 0x0f);
+			} else {
+				run = b1 & 0x3f;
+			}
+			index[QOI_COLOR_HASH(px) % 64] = px;
+			blk[i++] = px.v;
+		}
+
+		if (channels == 3)
+			ops->compact(blk, n, pixels + 3 * px_pos);
+		else
+			memcpy(pixels + 4 * px_pos, blk, 4 * n);
+	}
+
+	return 1;
+}
+
+void *
+qoi_simd_decode(const void *data, int size, qoi_desc *desc, int channels)
+{
+	void *pixels;
+	size_t len;
+
+	if ((channels != 0 && channels != 3 && channels != 4) ||
+	    !qoi_simd_header(data, size, desc))
+		return NULL;
+
+	len = (size_t)desc->width * desc->height * (channels ? channels : desc->channels);
+	pixels = QOI_MALLOC(len);
+	if (pixels && !qoi_simd_decode_to(data, size, desc, channels, pixels, len)) {
+		QOI_FREE(pixels);
+		pixels = NULL;
+	}
+	return pixels;
+}
+
+#ifndef QOI_NO_STDIO
+int
+qoi_simd_write(const char *filename, const void *data, const qoi_desc *desc)
+{
+	FILE *f = fopen(filename, "wb");
+	void *encoded;
+	int size;
+
+	if (!f)
+		return 0;
+	encoded = qoi_simd_encode(data, desc, &size);
+	if (!encoded) {
+		fclose(f);
+		return 0;
+	}
+	if (fwrite(encoded, 1, size, f) != (size_t)size)
+		size = 0;
+	fclose(f);
+	QOI_FREE(encoded);
+	return size;
+}
+
+void *
+qoi_simd_read(const char *filename, qoi_desc *desc, int channels)
+{
+	FILE *f = fopen(filename, "rb");
+	int size, bytes_read;
+	void *pixels, *data;
+
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	if (size <= 0) {
+		fclose(f);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_SET);
+
+	data = QOI_MALLOC(size);
+	if (!data) {
+		fclose(f);
+		return NULL;
+	}
+	bytes_read = fread(data, 1, size, f);
+	fclose(f);
+
+	pixels = qoi_simd_decode(data, bytes_read, desc, channels);
+	QOI_FREE(data);
+	return pixels;
+}
+#endif /* QOI_NO_STDIO */
+
+#endif /* QOI_SIMD_IMPLEMENTATION */
@@ -0,0 +1,212 @@
+/* qoi codec throughput, reference against the vectorised paths */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "qoi.h"
+#include "qoi_simd.h"
+#include "qois.h"
+
+struct image {
+	const char *name;
+	qoi_desc desc;
+	unsigned char *pix;
+};
+
+static int iterations = 10;
+static int stripes = 16;
+
+static double
+clock_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static unsigned int
+rnd(unsigned int *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+/* smooth gradients with some noise and flat areas, close to shader output */
+static void
+synth(struct image *img, const char *name, int w, int h, int channels, int kind)
+{
+	unsigned int s = 0x2545f491;
+	unsigned char *p;
+	int x, y, c;
+
+	img->name = name;
+	img->desc = (qoi_desc){ w, h, channels, QOI_SRGB };
+	img->pix = p = malloc((size_t)w * h * channels);
+	if (!p) {
+		perror("malloc");
+		exit(1);
+	}
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			for (c = 0; c < channels; c++) {
+				unsigned int v;
+
+				switch (kind) {
+				case 0: /* gradient */
+					v = (x * (c + 1) + y * (3 - c)) / 4 + (rnd(&s) & 1);
+					break;
+				case 1: /* flat bands */
+					v = ((y / 16) * 40 + (x / 256) * 8 + c * 60);
+					break;
+				default: /* noise */
+					v = rnd(&s);
+					break;
+				}
+				if (c == 3)
+					v = kind == 2 ? v : 255 - (unsigned int)x / 64;
+				*p++ = v;
+			}
+		}
+	}
+}
+
+static int
+load(struct image *img, const char *file, int channels)
+{
+	img->name = file;
+	img->pix = qoi_read(file, &img->desc, channels);
+	if (!img->pix) {
+		fprintf(stderr, "%s: failed to read\n", file);
+		return 0;
+	}
+	img->desc.channels = channels;
+	return 1;
+}
+
+/* striped container on every core, checked against the source pixels */
+static int
+bench_striped(const struct image *img)
+{
+	size_t npx = (size_t)img->desc.width * img->desc.height;
+	int ch = img->desc.channels;
+	double t, enc = 1e30, dec = 1e30;
+	void *data = NULL, *pix = NULL;
+	int i, len, fail = 0;
+	qoi_desc d;
+
+	for (i = 0; i < iterations; i++) {
+		free(data);
+		t = clock_ms();
+		data = qois_encode(img->pix, &img->desc, stripes, 0, &len);
+		t = clock_ms() - t;
+		enc = t < enc ? t : enc;
+	}
+	for (i = 0; i < iterations; i++) {
+		free(pix);
+		t = clock_ms();
+		pix = qois_decode(data, len, &d, ch, 0);
+		t = clock_ms() - t;
+		dec = t < dec ? t : dec;
+	}
+	if (!pix || memcmp(pix, img->pix, npx * ch)) {
+		fprintf(stderr, "%s: striped output differs from source\n", img->name);
+		fail++;
+	}
+	printf("%s\t%d\tstripes\t%d\t%.1f\t%.1f\n", img->name, ch, len,
+	       npx / enc / 1e3, npx / dec / 1e3);
+	free(data);
+	free(pix);
+	return fail;
+}
+
+static int
+bench(const struct image *img)
+{
+	size_t npx = (size_t)img->desc.width * img->desc.height;
+	int ch = img->desc.channels;
+	int level, max = qoi_simd_level(), fail = 0;
+	int ref_len, len, i;
+	qoi_desc d;
+	void *ref, *ref_pix;
+
+	ref = qoi_encode(img->pix, &img->desc, &ref_len);
+	ref_pix = qoi_decode(ref, ref_len, &d, ch);
+	for (level = -1; level <= max; level++) {
+		double t, enc = 1e30, dec = 1e30;
+		void *data = NULL, *pix = NULL;
+
+		if (level >= 0)
+			qoi_simd_force(level);
+		for (i = 0; i < iterations; i++) {
+			free(data);
+			t = clock_ms();
+			data = level < 0 ? qoi_encode(img->pix, &img->desc, &len)
+				: qoi_simd_encode(img->pix, &img->desc, &len);
+			t = clock_ms() - t;
+			enc = t < enc ? t : enc;
+		}
+		for (i = 0; i < iterations; i++) {
+			free(pix);
+			t = clock_ms();
+			pix = level < 0 ? qoi_decode(ref, ref_len, &d, ch)
+				: qoi_simd_decode(ref, ref_len, &d, ch);
+			t = clock_ms() - t;
+			dec = t < dec ? t : dec;
+		}
+		if (len != ref_len || memcmp(data, ref, len) ||
+		    memcmp(pix, ref_pix, npx * ch)) {
+			fprintf(stderr, "%s: %s output differs from reference\n",
+				img->name, level < 0 ? "reference" : qoi_simd_name(level));
+			fail++;
+		}
+		printf("%s\t%d\t%s\t%d\t%.1f\t%.1f\n", img->name, ch,
+		       level < 0 ? "reference" : qoi_simd_name(level), len,
+		       npx / enc / 1e3, npx / dec / 1e3);
+		free(data);
+		free(pix);
+	}
+	qoi_simd_force(-1);
+	free(ref);
+	free(ref_pix);
+	return fail + bench_striped(img);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char *kinds[] = { "gradient", "bands", "noise" };
+	struct image img;
+	int i, k, ch, fail = 0;
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		iterations = atoi(argv[2]);
+		if (iterations < 1)
+			iterations = 1;
+		argc -= 2;
+		argv += 2;
+	}
+
+	printf("image\tchannels\timpl\tbytes\tenc_mpx_s\tdec_mpx_s\n");
+	for (ch = 3; ch <= 4; ch++) {
+		for (i = 1; i < argc; i++) {
+			if (!load(&img, argv[i], ch)) {
+				fail++;
+				continue;
+			}
+			fail += bench(&img);
+			free(img.pix);
+		}
+		if (argc > 1)
+			continue;
+		for (k = 0; k < 3; k++) {
+			synth(&img, kinds[k], 1920, 1080, ch, k);
+			fail += bench(&img);
+			free(img.pix);
+		}
+	}
+	return fail != 0;
+}
@@ -0,0 +1,300 @@
+/*
+ * Striped qoi container. The image is cut into horizontal stripes, each one
+ * a complete qoi stream with its own index and run state, so the stripes of
+ * a single image can be encoded and decoded on separate threads.
+ *
+ * Layout, big endian like qoi:
+ *   "qois", width, height (u32), channels, colorspace (u8)
+ *   stripe count n (u32), n + 1 stripe offsets from the start (u32)
+ *   n qoi streams, stripe i holds rows [i * r, i * r + r) with
+ *   r = ceil(height / n), the last one possibly shorter
+ *
+ * qois_decode and qois_read take plain qoi files as well.
+ * Include after qoi.h and qoi_simd.h; define QOIS_IMPLEMENTATION in the same
+ * file as, and after, QOI_SIMD_IMPLEMENTATION.
+ */
+#ifndef QOIS_H
+#define QOIS_H
+
+#define QOIS_STRIPES_MAX 256
+
+void *qois_encode(const void *data, const qoi_desc *desc, int stripes,
+		  int threads, int *out_len);
+void *qois_decode(const void *data, int size, qoi_desc *desc, int channels,
+		  int threads);
+int qois_write(const char *filename, const void *data, const qoi_desc *desc,
+	       int stripes, int threads);
+void *qois_read(const char *filename, qoi_desc *desc, int channels, int threads);
+
+#endif /* QOIS_H */
+
+#ifdef QOIS_IMPLEMENTATION
+#include <pthread.h>
+#include <unistd.h>
+
+#define QOIS_MAGIC \
+	(((unsigned int)'q') << 24 | ((unsigned int)'o') << 16 | \
+	 ((unsigned int)'i') <<  8 | ((unsigned int)'s'))
+#define QOIS_HEADER_SIZE (QOI_HEADER_SIZE + 4)
+
+struct qois_job {
+	void (*fn)(struct qois_job *job, int stripe);
+	int next, count, fail;
+	qoi_desc desc;
+	int rows, channels;
+	unsigned char *pixels;
+
+	/* encode */
+	void *data[QOIS_STRIPES_MAX];
+	int len[QOIS_STRIPES_MAX];
+
+	/* decode */
+	const unsigned char *bytes;
+	unsigned int offset[QOIS_STRIPES_MAX + 1];
+};
+
+static void *
+qois_worker(void *arg)
+{
+	struct qois_job *job = arg;
+	int i;
+
+	while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count)
+		job->fn(job, i);
+	return NULL;
+}
+
+/* run every stripe on up to threads threads, 0 means one per core */
+static void
+qois_run(struct qois_job *job, int threads)
+{
+	pthread_t tid[QOIS_STRIPES_MAX];
+	int i, n = 0;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > job->count)
+		threads = job->count;
+	for (i = 1; i < threads; i++)
+		if (pthread_create(&tid[n], NULL, qois_worker, job) == 0)
+			n++;
+	qois_worker(job);
+	while (n--)
+		pthread_join(tid[n], NULL);
+}
+
+static int
+qois_stripe_rows(const struct qois_job *job, int i)
+{
+	int rows = job->desc.height - i * job->rows;
+
+	return rows < job->rows ? rows : job->rows;
+}
+
+static void
+qois_encode_stripe(struct qois_job *job, int i)
+{
+	size_t stride = (size_t)job->desc.width * job->desc.channels;
+	qoi_desc d = job->desc;
+
+	d.height = qois_stripe_rows(job, i);
+	job->data[i] = qoi_simd_encode(job->pixels + i * job->rows * stride, &d, &job->len[i]);
+	if (!job->data[i])
+		__atomic_store_n(&job->fail, 1, __ATOMIC_RELAXED);
+}
+
+static void
+qois_decode_stripe(struct qois_job *job, int i)
+{
+	size_t stride = (size_t)job->desc.width * job->channels;
+	int rows = qois_stripe_rows(job, i);
+	qoi_desc d;
+
+	if (!qoi_simd_decode_to(job->bytes + job->offset[i],
+				job->offset[i + 1] - job->offset[i], &d, job->channels,
+				job->pixels + i * job->rows * stride, rows * stride) ||
+	    d.width != job->desc.width || (int)d.height != rows)
+		__atomic_store_n(&job->fail, 1, __ATOMIC_RELAXED);
+}
+
+void *
+qois_encode(const void *data, const qoi_desc *desc, int stripes, int threads,
+	    int *out_len)
+{
+	struct qois_job *job;
+	unsigned char *bytes = NULL;
+	int i, p, size;
+
+	if (data == NULL || desc == NULL || out_len == NULL ||
+	    desc->width == 0 || desc->height == 0 ||
+	    desc->height >= QOI_PIXELS_MAX / desc->width)
+		return NULL;
+	job = QOI_MALLOC(sizeof(*job));
+	if (!job)
+		return NULL;
+	memset(job, 0, sizeof(*job));
+
+	if (stripes < 1)
+		stripes = 1;
+	if (stripes > QOIS_STRIPES_MAX)
+		stripes = QOIS_STRIPES_MAX;
+	if (stripes > (int)desc->height)
+		stripes = desc->height;
+	job->fn = qois_encode_stripe;
+	job->desc = *desc;
+	job->rows = (desc->height + stripes - 1) / stripes;
+	job->count = (desc->height + job->rows - 1) / job->rows;
+	job->pixels = (unsigned char *)data;
+	qois_run(job, threads);
+	if (job->fail)
+		goto out;
+
+	size = QOIS_HEADER_SIZE + 4 * (job->count + 1);
+	for (i = 0; i < job->count; i++)
+		size += job->len[i];
+	bytes = QOI_MALLOC(size);
+	if (!bytes)
+		goto out;
+
+	p = 0;
+	qoi_write_32(bytes, &p, QOIS_MAGIC);
+	qoi_write_32(bytes, &p, desc->width);
+	qoi_write_32(bytes, &p, desc->height);
+	bytes[p++] = desc->channels;
+	bytes[p++] = desc->colorspace;
+	qoi_write_32(bytes, &p, job->count);
+	size = p + 4 * (job->count + 1);
+	for (i = 0; i <= job->count; i++) {
+		qoi_write_32(bytes, &p, size);
+		if (i < job->count)
+			size += job->len[i];
+	}
+	for (i = 0; i < job->count; i++) {
+		memcpy(bytes + p, job->data[i], job->len[i]);
+		p += job->len[i];
+	}
+	*out_len = p;
+out:
+	for (i = 0; i < job->count; i++)
+		QOI_FREE(job->data[i]);
+	QOI_FREE(job);
+	return bytes;
+}
+
+void *
+qois_decode(const void *data, int size, qoi_desc *desc, int channels,
+	    int threads)
+{
+	const unsigned char *bytes = data;
+	struct qois_job *job;
+	void *pixels = NULL;
+	int i, p = 0;
+
+	if (data == NULL || desc == NULL || size < QOIS_HEADER_SIZE ||
+	    (channels != 0 && channels != 3 && channels != 4))
+		return NULL;
+	if (qoi_read_32(bytes, &p) != QOIS_MAGIC)
+		return qoi_simd_decode(data, size, desc, channels);
+
+	desc->width = qoi_read_32(bytes, &p);
+	desc->height = qoi_read_32(bytes, &p);
+	desc->channels = bytes[p++];
+	desc->colorspace = bytes[p++];
+	if (desc->width == 0 || desc->height == 0 ||
+	    desc->channels < 3 || desc->channels > 4 ||
+	    desc->colorspace > 1 ||
+	    desc->height >= QOI_PIXELS_MAX / desc->width)
+		return NULL;
+
+	job = QOI_MALLOC(sizeof(*job));
+	if (!job)
+		return NULL;
+	memset(job, 0, sizeof(*job));
+	job->fn = qois_decode_stripe;
+	job->desc = *desc;
+	job->channels = channels ? channels : desc->channels;
+	job->bytes = bytes;
+	job->count = qoi_read_32(bytes, &p);
+	if (job->count < 1 || job->count > QOIS_STRIPES_MAX ||
+	    job->count > (int)desc->height ||
+	    size < p + 4 * (job->count + 1))
+		goto out;
+	job->rows = (desc->height + job->count - 1) / job->count;
+	if ((desc->height + job->rows - 1) / job->rows != (unsigned int)job->count)
+		goto out;
+	for (i = 0; i <= job->count; i++) {
+		job->offset[i] = qoi_read_32(bytes, &p);
+		if (job->offset[i] > (unsigned int)size ||
+		    (i == 0 && job->offset[i] < (unsigned int)p + 4 * job->count) ||
+		    (i > 0 && job->offset[i] < job->offset[i - 1]))
+			goto out;
+	}
+
+	job->pixels = QOI_MALLOC((size_t)desc->width * desc->height * job->channels);
+	if (!job->pixels)
+		goto out;
+	qois_run(job, threads);
+	if (job->fail)
+		QOI_FREE(job->pixels);
+	else
+		pixels = job->pixels;
+out:
+	QOI_FREE(job);
+	return pixels;
+}
+
+#ifndef QOI_NO_STDIO
+int
+qois_write(const char *filename, const void *data, const qoi_desc *desc,
+	   int stripes, int threads)
+{
+	FILE *f = fopen(filename, "wb");
+	void *encoded;
+	int size;
+
+	if (!f)
+		return 0;
+	encoded = qois_encode(data, desc, stripes, threads, &size);
+	if (!encoded) {
+		fclose(f);
+		return 0;
+	}
+	if (fwrite(encoded, 1, size, f) != (size_t)size)
+		size = 0;
+	fclose(f);
+	QOI_FREE(encoded);
+	return size;
+}
+
+void *
+qois_read(const char *filename, qoi_desc *desc, int channels, int threads)
+{
+	FILE *f = fopen(filename, "rb");
+	int size, bytes_read;
+	void *pixels, *data;
+
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	if (size <= 0) {
+		fclose(f);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_SET);
+
+	data = QOI_MALLOC(size);
+	if (!data) {
+		fclose(f);
+		return NULL;
+	}
+	bytes_read = fread(data, 1, size, f);
+	fclose(f);
+
+	pixels = qois_decode(data, bytes_read, desc, channels, threads);
+	QOI_FREE(data);
+	return pixels;
+}
+#endif /* QOI_NO_STDIO */
+
+#endif /* QOIS_IMPLEMENTATION */
@@ -0,0 +1,409 @@
+/*
+ * Shader source text: the #version/#extension preamble and the expansion
+ * of #include "file" directives, kept apart from the gl code so srccheck
+ * can run them without a context. Define SRC_IMPLEMENTATION in one file;
+ * SRC_DIE reports allocation failures and SRC_INCLUDE_ADDED(inc) is
+ * called for every file added to the include table.
+ */
+#ifndef SRC_H
+#define SRC_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define HASH64_INIT 0xcbf29ce484222325ULL
+
+/* growing buffer */
+struct text {
+	char *p;
+	size_t len, size;
+};
+
+/*
+ * Files pulled in by #include "file", relative to the file including them.
+ * Each is kept expanded, its own includes inlined between #line directives
+ * numbering its lines as source string 1 + its index, so compiler logs can
+ * be mapped back. deps has the bit of every include it pulls in, its own
+ * too, and a change drops all the expansions and rebuilds all the shaders
+ * having its bit. A file included twice is inlined twice, libraries shared
+ * that way want the usual #ifndef guards.
+ */
+#define INCLUDE_MAX 32
+struct include {
+	char *path;
+	char *text;	/* expanded, NULL until needed again */
+	size_t len;
+	uint64_t hash;	/* of the file and its own includes */
+	uint32_t deps;
+	int old;	/* numbered for the #line of GLSL before 3.30 */
+	int busy;	/* being expanded */
+	int wd;
+	double due;	/* end of the debounce, 0 when idle */
+	time_t time;
+};
+struct include_table {
+	pthread_mutex_t lock;
+	struct include file[INCLUDE_MAX];
+	size_t count;
+	unsigned long loads, hits, changes;
+};
+extern struct include_table includes;
+
+uint64_t hash64(uint64_t h, const void *data, size_t len);
+const char *path_base(const char *path);
+void path_dir(char *dir, size_t size, const char *path);
+void text_push(struct text *t, const char *str, size_t len);
+char *read_file(const char *name, size_t *len);
+int is_word(char c);
+const char *skip_blank(const char *p, const char *end);
+const char *next_word(const char *p, const char *end, char *word, size_t size);
+const char *src_preamble(const char *txt, size_t len, long *version);
+const char *include_line(const char *p, const char *eol, size_t *n);
+int src_has_include(const char *txt, size_t len);
+int include_get(const char *path);
+int include_expand(struct text *out, uint64_t *hash, uint32_t *deps, const char *name,
+		   int id, const char *txt, size_t len, int old);
+int include_load(int i, int old);
+const char *include_name(unsigned long id, const char *name);
+
+#endif /* SRC_H */
+
+#ifdef SRC_IMPLEMENTATION
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef SRC_DIE
+#define SRC_DIE(...) (fprintf(stderr, __VA_ARGS__), exit(1))
+#endif
+#ifndef SRC_INCLUDE_ADDED
+#define SRC_INCLUDE_ADDED(inc) ((void)(inc))
+#endif
+
+struct include_table includes = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* fnv-1a */
+uint64_t
+hash64(uint64_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--)
+		h = (h ^ *p++) * 0x100000001b3ULL;
+	return h;
+}
+
+const char *
+path_base(const char *path)
+{
+	const char *p = strrchr(path, '/');
+
+	return p ? p + 1 : path;
+}
+
+void
+path_dir(char *dir, size_t size, const char *path)
+{
+	size_t n = path_base(path) - path;
+
+	snprintf(dir, size, "%.*s", (int)(n ? n : 1), n ? path : ".");
+}
+
+void
+text_push(struct text *t, const char *str, size_t len)
+{
+	if (t->len + len + 1 > t->size) {
+		t->size = t->size * 2 > t->len + len + 1 ? t->size * 2 : t->len + len + 1;
+		t->p = realloc(t->p, t->size);
+		if (!t->p)
+			SRC_DIE("realloc: %s\n", strerror(errno));
+	}
+	memcpy(t->p + t->len, str, len);
+	t->len += len;
+	t->p[t->len] = '\0';
+}
+
+/* the whole file, in a buffer to free */
+char *
+read_file(const char *name, size_t *len)
+{
+	struct text t = { NULL, 0, 0 };
+	char buf[4096];
+	ssize_t n;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	text_push(&t, "", 0);
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		text_push(&t, buf, n);
+	close(fd);
+	if (n < 0) {
+		free(t.p);
+		return NULL;
+	}
+	*len = t.len;
+	return t.p;
+}
+
+int
+is_word(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+		|| (c >= '0' && c <= '9') || c == '_';
+}
+
+const char *
+skip_blank(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+const char *
+next_word(const char *p, const char *end, char *word, size_t size)
+{
+	size_t n = 0;
+
+	p = skip_blank(p, end);
+	while (p < end && is_word(*p)) {
+		if (n + 1 < size)
+			word[n++] = *p;
+		p++;
+	}
+	word[n] = '\0';
+	return p;
+}
+
+/* end of the #version/#extension preamble, with the #version number */
+const char *
+src_preamble(const char *txt, size_t len, long *version)
+{
+	const char *p, *eol, *last, *end = txt + len;
+	char word[16];
+
+	*version = 0;
+	for (p = last = txt; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		p = skip_blank(p, eol);
+		if (p == eol || *p == '\r' || (p + 1 < eol && p[0] == '/' && p[1] == '/'))
+			continue;
+		if (*p != '#')
+			break;
+		p = next_word(p + 1, eol, word, sizeof(word));
+		if (strcmp(word, "version") == 0) {
+			*version = 0;
+			/* the source may end right after, unterminated */
+			for (p = skip_blank(p, eol); p < eol && *p >= '0' && *p <= '9'; p++)
+				*version = *version * 10 + *p - '0';
+		} else if (strcmp(word, "extension") != 0)
+			break;
+		last = eol + 1;
+	}
+	return last;
+}
+
+/* the file name after #include on the line, or NULL */
+const char *
+include_line(const char *p, const char *eol, size_t *n)
+{
+	const char *q;
+	char word[16];
+
+	p = skip_blank(p, eol);
+	if (p == eol || *p != '#')
+		return NULL;
+	p = next_word(p + 1, eol, word, sizeof(word));
+	if (strcmp(word, "include") != 0)
+		return NULL;
+	p = skip_blank(p, eol);
+	if (p == eol || *p != '"' || !(q = memchr(p + 1, '"', eol - p - 1))) {
+		*n = 0;
+		return p;
+	}
+	*n = q - p - 1;
+	return p + 1;
+}
+
+int
+src_has_include(const char *txt, size_t len)
+{
+	const char *p, *eol, *end = txt + len;
+	size_t n;
+
+	for (p = txt; p < end; p = eol + 1) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		if (include_line(p, eol, &n))
+			return 1;
+	}
+	return 0;
+}
+
+/* index of the include, added on first use, -1 when the table is full */
+int
+include_get(const char *path)
+{
+	struct include *inc;
+	struct stat sb;
+	size_t i, n;
+
+	for (i = 0; i < includes.count; i++)
+		if (strcmp(includes.file[i].path, path) == 0)
+			return i;
+	if (includes.count == INCLUDE_MAX)
+		return -1;
+
+	inc = &includes.file[i];
+	memset(inc, 0, sizeof(*inc));
+	/* no strdup, this builds under plain c99 */
+	n = strlen(path) + 1;
+	inc->path = malloc(n);
+	if (!inc->path)
+		SRC_DIE("malloc: %s\n", strerror(errno));
+	memcpy(inc->path, path, n);
+	inc->deps = 1u << i;
+	inc->wd = -1;
+	if (stat(path, &sb) == 0)
+		inc->time = sb.st_ctime;
+	SRC_INCLUDE_ADDED(inc);
+	/* log_print reads the paths without the lock */
+	__atomic_store_n(&includes.count, i + 1, __ATOMIC_RELEASE);
+	return i;
+}
+
+/*
+ * Append txt from file name, numbered as source string id, to out with its
+ * includes inlined, and fold it into hash. Every include met is added to
+ * deps, even one failing to load, so fixing it brings a rebuild.
+ */
+int
+include_expand(struct text *out, uint64_t *hash, uint32_t *deps, const char *name,
+	       int id, const char *txt, size_t len, int old)
+{
+	const char *p, *eol, *inc, *last = txt, *end = txt + len;
+	char path[4096], buf[64];
+	int line, i, n, loaded, ret = 1;
+	size_t size;
+
+	for (p = txt, line = 1; p < end; p = eol + 1, line++) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		inc = include_line(p, eol, &size);
+		if (!inc)
+			continue;
+
+		/* the directive line goes, the text before stays */
+		text_push(out, last, p - last);
+		*hash = hash64(*hash, last, p - last);
+		last = eol < end ? eol + 1 : end;
+		if (!size) {
+			fprintf(stderr, "%s:%d: expected #include \"file\"\n", name, line);
+			ret = 0;
+			continue;
+		}
+		if (*inc == '/')
+			snprintf(path, sizeof(path), "%.*s", (int)size, inc);
+		else
+			snprintf(path, sizeof(path), "%.*s%.*s", (int)(path_base(name) - name),
+				 name, (int)size, inc);
+		i = include_get(path);
+		if (i < 0) {
+			fprintf(stderr, "%s:%d: more than %d includes\n", name, line, INCLUDE_MAX);
+			ret = 0;
+			continue;
+		}
+		loaded = include_load(i, old);
+		*deps |= includes.file[i].deps;
+		if (!loaded) {
+			fprintf(stderr, "%s:%d: cannot include %s\n", name, line, path);
+			ret = 0;
+			continue;
+		}
+		*hash = hash64(*hash, &includes.file[i].hash, sizeof(includes.file[i].hash));
+
+		/* before 3.30, #line N numbers the following line N + 1 */
+		n = snprintf(buf, sizeof(buf), "#line %d %d\n", old ? 0 : 1, i + 1);
+		text_push(out, buf, n);
+		text_push(out, includes.file[i].text, includes.file[i].len);
+		n = snprintf(buf, sizeof(buf), "#line %d %d\n", old ? line : line + 1, id);
+		text_push(out, buf, n);
+	}
+	text_push(out, last, end - last);
+	*hash = hash64(*hash, last, end - last);
+	return ret;
+}
+
+/* expand include i unless cached, with the lock held */
+int
+include_load(int i, int old)
+{
+	struct include *inc = &includes.file[i];
+	struct text t = { NULL, 0, 0 };
+	uint64_t hash = HASH64_INIT;
+	uint32_t deps = 1u << i;
+	size_t len;
+	char *raw;
+	int ret;
+
+	if (inc->text && inc->old == old) {
+		includes.hits++;
+		return 1;
+	}
+	if (inc->busy) {
+		fprintf(stderr, "%s: includes itself\n", inc->path);
+		return 0;
+	}
+	raw = read_file(inc->path, &len);
+	if (!raw) {
+		fprintf(stderr, "%s: %s\n", inc->path, strerror(errno));
+		return 0;
+	}
+
+	inc->busy = 1;
+	ret = include_expand(&t, &hash, &deps, inc->path, i + 1, raw, len, old);
+	inc->busy = 0;
+	free(raw);
+	inc->deps |= deps;
+	if (!ret) {
+		free(t.p);
+		return 0;
+	}
+	/* the #line after it must start a line of its own */
+	if (!t.len || t.p[t.len - 1] != '\n')
+		text_push(&t, "\n", 1);
+	free(inc->text);
+	inc->text = t.p;
+	inc->len = t.len;
+	inc->hash = hash;
+	inc->deps = deps;
+	inc->old = old;
+	includes.loads++;
+	return 1;
+}
+
+const char *
+include_name(unsigned long id, const char *name)
+{
+	if (id == 0)
+		return name;
+	if (id > __atomic_load_n(&includes.count, __ATOMIC_ACQUIRE))
+		return NULL;
+	return includes.file[id - 1].path;
+}
+
+#endif /* SRC_IMPLEMENTATION */
@@ -0,0 +1,254 @@
+/* checks of the shader source text handling, run on every reload in bonz */
+/* as config.mk, for make's own c99 -O1 when CFLAGS is not set */
+#define _XOPEN_SOURCE 500
+#define _POSIX_C_SOURCE 200112L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SRC_IMPLEMENTATION
+#include "src.h"
+
+static char dir[64];
+static int failed;
+
+#define CHECK(c) check((c), #c, __LINE__)
+
+static void
+check(int ok, const char *what, int line)
+{
+	if (!ok) {
+		fprintf(stderr, "srccheck.c:%d: failed: %s\n", line, what);
+		failed++;
+	}
+}
+
+static const char *
+path(const char *name)
+{
+	static char buf[2][256];
+	static int i;
+
+	i = !i;
+	snprintf(buf[i], sizeof(buf[i]), "%s/%s", dir, name);
+	return buf[i];
+}
+
+static void
+put(const char *name, const char *txt)
+{
+	FILE *f = fopen(path(name), "w");
+
+	if (!f || fputs(txt, f) < 0 || fclose(f)) {
+		perror(path(name));
+		exit(1);
+	}
+}
+
+/* forget every include, as bonz does only when one changes */
+static void
+reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < includes.count; i++) {
+		unlink(includes.file[i].path);
+		free(includes.file[i].path);
+		free(includes.file[i].text);
+	}
+	memset(includes.file, 0, sizeof(includes.file));
+	includes.count = 0;
+}
+
+/* expand name, the errors expected from the failing cases are not shown */
+static int
+expand(const char *name, int old, struct text *out, uint64_t *hash, uint32_t *deps,
+       int quiet)
+{
+	size_t len;
+	char *txt;
+	int err = -1, ret;
+
+	txt = read_file(path(name), &len);
+	if (!txt) {
+		perror(path(name));
+		exit(1);
+	}
+	memset(out, 0, sizeof(*out));
+	*hash = HASH64_INIT;
+	*deps = 0;
+	if (quiet) {
+		fflush(stderr);
+		err = dup(2);
+		if (!freopen("/dev/null", "w", stderr))
+			exit(1);
+	}
+	ret = include_expand(out, hash, deps, path(name), 0, txt, len, old);
+	if (quiet) {
+		fflush(stderr);
+		dup2(err, 2);
+		close(err);
+	}
+	unlink(path(name));
+	free(txt);
+	return ret;
+}
+
+static void
+check_preamble(void)
+{
+	static const struct {
+		const char *src;
+		size_t split;	/* from the start, where the bonz block goes */
+		long version;
+	} t[] = {
+		{ "void main() {}\n", 0, 0 },
+		{ "#version 330\nvoid main() {}\n", 13, 330 },
+		{ "#version 150 core\n#extension GL_A : enable\nout vec4 c;\n", 43, 150 },
+		{ "// header\n\n#version 400\n#define X 1\n", 24, 400 },
+		{ "#version 330\r\n#extension GL_A : require\r\nvoid main() {}\n", 41, 330 },
+		{ "  #  version 120\n\t#extension GL_A : enable\n", 43, 120 },
+		{ "#define X\n#version 330\n", 0, 0 },
+	};
+	const char *unterminated = "#version 460";
+	long version;
+	size_t i;
+
+	for (i = 0; i < sizeof(t) / sizeof(*t); i++) {
+		CHECK(src_preamble(t[i].src, strlen(t[i].src), &version) == t[i].src + t[i].split);
+		CHECK(version == t[i].version);
+	}
+	/* past the end, the caller then keeps the source whole */
+	CHECK(src_preamble(unterminated, strlen(unterminated), &version) >
+	      unterminated + strlen(unterminated) - 1);
+	CHECK(version == 460);
+}
+
+static void
+check_include(void)
+{
+	struct text out;
+	uint64_t hash, again;
+	uint32_t deps;
+	unsigned long hits;
+
+	/* includes are inlined, numbered as strings 1 + their index */
+	put("lib.glsl", "float f() { return 1.0; }\n#include \"sub/inner.glsl\"\n");
+	mkdir(path("sub"), 0700);
+	put("sub/inner.glsl", "float g() { return 2.0; }");
+	put("main.glsl", "#version 330\n#include \"lib.glsl\"\nvoid main() {}\n");
+	CHECK(expand("main.glsl", 0, &out, &hash, &deps, 0));
+	CHECK(strcmp(out.p,
+		     "#version 330\n"
+		     "#line 1 1\n"
+		     "float f() { return 1.0; }\n"
+		     "#line 1 2\n"
+		     "float g() { return 2.0; }\n"
+		     "#line 3 1\n"
+		     "#line 3 0\n"
+		     "void main() {}\n") == 0);
+	CHECK(deps == 3);
+	free(out.p);
+
+	/* before 3.30, #line N numbers the following line N + 1 */
+	put("main.glsl", "#version 120\n#include \"lib.glsl\"\nvoid main() {}\n");
+	CHECK(expand("main.glsl", 1, &out, &hash, &deps, 0));
+	CHECK(strcmp(out.p,
+		     "#version 120\n"
+		     "#line 0 1\n"
+		     "float f() { return 1.0; }\n"
+		     "#line 0 2\n"
+		     "float g() { return 2.0; }\n"
+		     "#line 2 1\n"
+		     "#line 2 0\n"
+		     "void main() {}\n") == 0);
+	free(out.p);
+
+	/* the expansions are kept, and the hash covers the included text */
+	put("main.glsl", "#include \"lib.glsl\"\n");
+	hits = includes.hits;
+	CHECK(expand("main.glsl", 1, &out, &hash, &deps, 0));
+	CHECK(includes.hits == hits + 1);
+	free(out.p);
+	put("main.glsl", "#include \"lib.glsl\"\n");
+	CHECK(expand("main.glsl", 1, &out, &again, &deps, 0));
+	CHECK(hash == again);
+	free(out.p);
+	put("sub/inner.glsl", "float g() { return 3.0; }");
+	free(includes.file[0].text);
+	free(includes.file[1].text);
+	includes.file[0].text = includes.file[1].text = NULL;
+	put("main.glsl", "#include \"lib.glsl\"\n");
+	CHECK(expand("main.glsl", 1, &out, &again, &deps, 0));
+	CHECK(hash != again);
+	free(out.p);
+	reset();
+	rmdir(path("sub"));
+
+	/* cycles fail instead of recursing, and still report their deps */
+	put("a.glsl", "#include \"b.glsl\"\n");
+	put("b.glsl", "#include \"a.glsl\"\n");
+	put("main.glsl", "#include \"a.glsl\"\n");
+	CHECK(!expand("main.glsl", 0, &out, &hash, &deps, 1));
+	CHECK(deps == 3);
+	free(out.p);
+	put("self.glsl", "#include \"self.glsl\"\n");
+	put("main.glsl", "#include \"self.glsl\"\n");
+	CHECK(!expand("main.glsl", 0, &out, &hash, &deps, 1));
+	free(out.p);
+	reset();
+
+	/* a missing file is a dependency, creating it brings a rebuild */
+	put("main.glsl", "#include \"missing.glsl\"\n");
+	CHECK(!expand("main.glsl", 0, &out, &hash, &deps, 1));
+	CHECK(deps == 1);
+	free(out.p);
+	put("main.glsl", "#include missing.glsl\n");
+	CHECK(!expand("main.glsl", 0, &out, &hash, &deps, 1));
+	free(out.p);
+	reset();
+}
+
+/* every new file takes an entry, the table is not grown */
+static void
+check_include_max(void)
+{
+	struct text src = { NULL, 0, 0 }, out;
+	char name[32], line[64];
+	uint64_t hash;
+	uint32_t deps;
+	int i;
+
+	for (i = 0; i <= INCLUDE_MAX; i++) {
+		snprintf(name, sizeof(name), "f%d.glsl", i);
+		put(name, "");
+		snprintf(line, sizeof(line), "#include \"%s\"\n", name);
+		text_push(&src, line, strlen(line));
+	}
+	put("main.glsl", src.p);
+	CHECK(!expand("main.glsl", 0, &out, &hash, &deps, 1));
+	CHECK(includes.count == INCLUDE_MAX);
+	CHECK(deps == 0xffffffff);
+	free(out.p);
+	free(src.p);
+	unlink(path(name));
+	reset();
+}
+
+int
+main(void)
+{
+	snprintf(dir, sizeof(dir), "/tmp/srccheck.%ld", (long)getpid());
+	if (mkdir(dir, 0700)) {
+		perror(dir);
+		return 1;
+	}
+	check_preamble();
+	check_include();
+	check_include_max();
+	rmdir(dir);
+	if (!failed)
+		printf("srccheck: ok\n");
+	return failed != 0;
+}